@@ -2,6 +2,7 @@
 #define SMARTREST_H
 #include <vector>
 #include <string>
+#include <stdint.h>
 /**
  *  \class SrLexer
  *  \brief Lexical scanner for SmartREST messages.
@@ -26,11 +27,41 @@ public:
          *  with its data type.
          */
         typedef std::pair<SrTokType, std::string> SrToken;
+        /**
+         *  \struct SrSpan
+         *  \brief Non-owning token, located by offset and length in the
+         *  buffer being scanned.
+         *
+         *  For a quoted value, the span excludes the enclosing double quotes.
+         *  When \a esc is set, the span still contains the escaped double
+         *  quotes ("") verbatim, use value() for obtaining the unescaped
+         *  string.
+         */
+        struct SrSpan {
+                /** \brief Scanned type of the token. */
+                SrTokType type;
+                /** \brief Offset of the value in the buffer. */
+                size_t pos;
+                /** \brief Length of the value. */
+                size_t len;
+                /** \brief Whether the value contains escaped double quotes. */
+                bool esc;
+        };
         /**
          *  \brief SrLexer constructor.
          *  \param _s the string for lexical scanning.
          */
         SrLexer(const std::string& _s) {reset(_s);}
+        /**
+         *  \brief SrLexer constructor, borrowing the buffer.
+         *
+         *  Unlike its counterpart, the buffer is not copied, the caller must
+         *  keep \a buf alive and unmodified as long as the lexer is in use.
+         *
+         *  \param buf pointer to the buffer for lexical scanning.
+         *  \param len size of the buffer.
+         */
+        SrLexer(const char *buf, size_t len) {reset(buf, len);}
         virtual ~SrLexer() {}
         /**
          *  \brief Get the next token from the lexer.
@@ -43,6 +74,34 @@ public:
          *  \return the next CSV value with its type information as a token.
          */
         SrToken next();
+        /**
+         *  \brief Get the next token from the lexer, without copying.
+         *
+         *  Zero-copy counterpart of next(), the returned span refers to the
+         *  buffer of the lexer. Both functions share the same state, hence
+         *  they can be mixed.
+         *
+         *  \return the next CSV value as a span into the buffer.
+         */
+        SrSpan scan();
+        /**
+         *  \brief Materialize the value of a span returned by scan().
+         *
+         *  Escaped double quotes are unescaped, this is the only case when
+         *  the value differs from the raw characters of the span.
+         *
+         *  \param tok span returned by scan() of this lexer.
+         *  \param dest string to be assigned with the value.
+         */
+        void value(const SrSpan &tok, std::string &dest) const;
+        /**
+         *  \brief Same as value(), except the value is appended to \a dest.
+         */
+        void append(const SrSpan &tok, std::string &dest) const;
+        /**
+         *  \brief Get the buffer of the lexer, which all spans refer to.
+         */
+        const char *data() const {return ext ? ext : own.data();}
         /**
          *  \brief Check if the given tokens is a delimiter for a
          *  SmartREST record.
@@ -67,9 +126,29 @@ public:
          *  \param _s the new string for lexing.
          */
         void reset(const std::string &_s) {
-                s = _s;
+                own = _s;
+                ext = NULL;
+                n = own.size();
+                pre = start = end = 0;
+                delimit = false;
+                index();
+        }
+        /**
+         *  \brief Reset the lexer with a borrowed buffer.
+         *
+         *  Same as reset(), except the buffer is not copied, the caller must
+         *  keep \a buf alive and unmodified as long as the lexer is in use.
+         *
+         *  \param buf pointer to the new buffer for lexing.
+         *  \param len size of the buffer.
+         */
+        void reset(const char *buf, size_t len) {
+                own.clear();
+                ext = buf;
+                n = len;
                 pre = start = end = 0;
                 delimit = false;
+                index();
         }
 
 public:
@@ -87,17 +166,44 @@ public:
         size_t end;
 
 private:
-        std::string s;
+        /**
+         *  \brief Build the structural index of the buffer.
+         *
+         *  Every 64 bytes of the buffer are classified into bitmasks at once
+         *  (vectorized when the CPU supports it), scan() then jumps between
+         *  the structural characters instead of testing byte by byte.
+         */
+        void index();
+        size_t find(int k, size_t pos, bool inv = false) const;
+        size_t count(int k, size_t pos, size_t end) const;
+
+        std::string own;
+        std::vector<uint64_t> idx;
+        const char *ext;
+        size_t n;
         bool delimit;
 };
 
 
+/**
+ *  \brief Number of fields a SrRecord stores without heap allocation.
+ */
+#define SR_RECORD_INLINE 8
+
 /**
  *  \class SrRecord
  *  \brief Data structure represents a SmartREST record.
  *
  *  A SmartREST record is a list of CSVs (comma separated values), along with
  *  its scanned type returned from a SrLexer.
+ *
+ *  A record filled by SrParser::next(SrRecord&) does not copy the values,
+ *  they refer to the buffer of the parser, and the field descriptors are
+ *  stored inline up to SR_RECORD_INLINE fields. Refilling the same record
+ *  reuses all its storage, hence parsing is allocation-free once the record
+ *  has grown to the largest record seen. Only values with escaped double
+ *  quotes, and values appended via push_back(), are stored in the record.
+ *  \note A copy of a record always owns all its values.
  */
 class SrRecord
 {
@@ -105,32 +211,47 @@ public:
         /**
          *  \brief SrRecord constructor.
          */
-        SrRecord() {}
+        SrRecord(): buf(NULL), n(0), ntok(0) {}
+        /**
+         *  \brief SrRecord copy constructor, the copy owns all its values.
+         */
+        SrRecord(const SrRecord &r): buf(NULL), n(0), ntok(0) {*this = r;}
         virtual ~SrRecord() {}
+        /**
+         *  \brief SrRecord assignment, the copy owns all its values.
+         */
+        SrRecord &operator=(const SrRecord &r);
 
         /**
          *  \brief Append a token to the record.
          *  \param tok token to be appended.
          */
-        void push_back(SrLexer::SrToken &tok) {data.push_back(tok);}
+        void push_back(SrLexer::SrToken &tok);
         /**
          *  \brief Get the i-th token from the record.
+         *
+         *  \note The tokens are materialized on the first call after the
+         *  record is (re-)filled, prefer data() and length() on hot paths.
+         *
          *  \param i index, cause undefined behavior if i is out of range.
          *  \return the token at position i.
          */
-        const SrLexer::SrToken &operator[](size_t i) const {return data[i];}
+        const SrLexer::SrToken &operator[](size_t i) const {
+                if (ntok != n) materialize();
+                return toks[i];
+        }
         /**
          *  \brief Get the value of i-th token.
          *  \param i index, cause undefined behavior if i is out of range.
          *  \return the string representation at i-th token.
          */
-        const std::string &value(size_t i) const {return data[i].second;}
+        const std::string &value(size_t i) const {return (*this)[i].second;}
         /**
          *  \brief Get the type of i-th token.
          *  \param i index, cause undefined behavior if i is out of range.
          *  \return the scanned type by a SrLexer.
          */
-        SrLexer::SrTokType type(size_t i) const {return data[i].first;}
+        SrLexer::SrTokType type(size_t i) const {return field(i).type;}
         /**
          *  \brief Get the type of i-th token at an integer.
          *
@@ -141,15 +262,104 @@ public:
          *  \param i index, cause undefined behavior if i is out of range.
          *  \return the token type as an integer.
          */
-        int typeInt(size_t i) const {return data[i].first;}
+        int typeInt(size_t i) const {return field(i).type;}
         /**
          *  \brief Return the size of the record.
          *  \return number of tokens in the record.
          */
-        size_t size() const {return data.size();}
+        size_t size() const {return n;}
+        /**
+         *  \brief Get a pointer to the value of i-th token, without copying.
+         *  \note The value is NOT null-terminated, use length() for its size.
+         *  \param i index, cause undefined behavior if i is out of range.
+         */
+        const char *data(size_t i) const {
+                const _Field &f = field(i);
+                return (f.own ? arena.data() : buf) + f.pos;
+        }
+        /**
+         *  \brief Get the length of the value of i-th token.
+         *  \param i index, cause undefined behavior if i is out of range.
+         */
+        size_t length(size_t i) const {return field(i).len;}
+        /**
+         *  \brief Check if the value of i-th token equals to \a s.
+         *  \param i index, cause undefined behavior if i is out of range.
+         *  \param s null-terminated string to compare with.
+         */
+        bool equals(size_t i, const char *s) const;
+        /**
+         *  \brief Get the value of i-th token as an integer.
+         *
+         *  The value is converted the same way as strtol() on the first call,
+         *  and cached in the record, later calls do not re-parse it.
+         *  \param i index, cause undefined behavior if i is out of range.
+         */
+        long asInt(size_t i) const {
+                const _Field &f = field(i);
+                return f.cached & _INT ? f.ival : toInt(f);
+        }
+        /**
+         *  \brief Get the value of i-th token as a floating point number.
+         *
+         *  The value is converted the same way as strtod() on the first call,
+         *  and cached in the record.
+         *  \param i index, cause undefined behavior if i is out of range.
+         */
+        double asDouble(size_t i) const {
+                const _Field &f = field(i);
+                return f.cached & _DOUBLE ? f.dval : toDouble(f);
+        }
+        /**
+         *  \brief Get the message ID, i.e., the first token as an integer.
+         *
+         *  The message ID is converted while the record is being filled,
+         *  hence message dispatching does no string conversion at all.
+         */
+        unsigned long asMsgId() const {return n ? asInt(0) : 0;}
+        /**
+         *  \brief Remove all tokens, the storage is kept for re-use.
+         */
+        void clear() {
+                buf = NULL;
+                n = ntok = 0;
+                ext.clear();
+                arena.clear();
+        }
 
 private:
-        std::vector<SrLexer::SrToken> data;
+        friend class SrParser;
+        enum {_INT = 1, _DOUBLE = 2};
+        struct _Field {
+                _Field() {}
+                _Field(uint32_t p, uint32_t l, SrLexer::SrTokType t, bool o):
+                        pos(p), len(l), type(t), own(o), cached(0), ival(0),
+                        dval(0) {}
+                uint32_t pos;
+                uint32_t len;
+                SrLexer::SrTokType type;
+                bool own;
+                mutable uint8_t cached;
+                mutable long ival;
+                mutable double dval;
+        };
+        const _Field &field(size_t i) const {
+                return i < SR_RECORD_INLINE ? fix[i] : ext[i-SR_RECORD_INLINE];
+        }
+        void append(const SrLexer &lex, const SrLexer::SrSpan &sp);
+        void append(SrLexer::SrTokType type, const char *s, size_t len);
+        void add(const _Field &f);
+        void materialize() const;
+        long toInt(const _Field &f) const;
+        double toDouble(const _Field &f) const;
+
+        const char *buf;
+        _Field fix[SR_RECORD_INLINE];
+        std::vector<_Field> ext;
+        std::string arena;
+        size_t n;
+        mutable size_t ntok;
+        mutable std::vector<SrLexer::SrToken> toks;
 };
 
 
@@ -169,6 +379,16 @@ public:
          *  \param _s message contains the hold request or response.
          */
         SrParser(const std::string &_s): lex(_s) {}
+        /**
+         *  \brief SrParser constructor, borrowing the buffer.
+         *
+         *  The buffer is not copied, the caller must keep \a buf alive and
+         *  unmodified as long as the parser is in use.
+         *
+         *  \param buf pointer to the buffer contains the request or response.
+         *  \param len size of the buffer.
+         */
+        SrParser(const char *buf, size_t len): lex(buf, len) {}
         virtual ~SrParser() {}
         /**
          *  \brief Get the next SmartREST record.
@@ -182,19 +402,41 @@ public:
          */
         SrRecord next() {
                 SrRecord r;
-                SrLexer::SrToken t = lex.next();
+                next(r);
+                return SrRecord(r); // the copy owns its values
+        }
+        /**
+         *  \brief Get the next SmartREST record, refilling \a r in place.
+         *
+         *  Same as next(), except the record is re-used instead of created,
+         *  and its values refer to the buffer of the parser, see SrRecord.
+         *
+         *  \param r the record to be refilled.
+         *  \return number of tokens in the record, 0 when end of buffer.
+         */
+        size_t next(SrRecord &r) {
+                r.clear();
+                r.buf = lex.data();
+                SrLexer::SrSpan sp = lex.scan();
                 pre = lex.pre;
                 start = lex.start;
-                for (; !lex.isdelimiter(t); t = lex.next())
-                        r.push_back(t);
+                for (; sp.type != SrLexer::SR_NEWLINE &&
+                             sp.type != SrLexer::SR_EOB; sp = lex.scan())
+                        r.append(lex, sp);
                 end = lex.end;
-                return r;
+                return r.size();
         }
         /**
          *  \brief Reset the SmartREST parser with a new buffer.
          *  \param _s reference to the new buffer.
          */
         void reset(const std::string &_s) {lex.reset(_s);}
+        /**
+         *  \brief Reset the SmartREST parser with a borrowed buffer.
+         *  \param buf pointer to the new buffer.
+         *  \param len size of the buffer.
+         */
+        void reset(const char *buf, size_t len) {lex.reset(buf, len);}
 public:
         /**
          *  \brief Start position of a record, equals to pre of the first token
@@ -1,11 +1,13 @@
 #ifndef SRAGENT_H
 #define SRAGENT_H
 #include <map>
+#include <sys/epoll.h>
 #include "smartrest.h"
 #include "srqueue.h"
 #include "srbootstrap.h"
 #include "srintegrate.h"
 #include "srtimer.h"
+#include "srmsgtable.h"
 
 
 /**
@@ -27,6 +29,24 @@ public:
 typedef SrMsgHandler AbstractMsgHandler;
 
 
+/**
+ *  \class SrFdHandler
+ *  \brief Virtual abstract functor for file descriptor callbacks.
+ */
+class SrFdHandler
+{
+public:
+        virtual ~SrFdHandler() {}
+        /**
+         *  \brief File descriptor handler interface.
+         *  \param fd the file descriptor which is ready.
+         *  \param events the ready events as reported by epoll.
+         *  \param agent reference to the SrAgent instance.
+         */
+        virtual void operator()(int fd, uint32_t events, SrAgent &agent) = 0;
+};
+
+
 /**
  *  \class SrAgent
  *  \brief Main implementation of a device agent.
@@ -118,6 +138,10 @@ public:
          *  \return 0 on success, -1 otherwise.
          */
         int send(const SrNews &news);
+        /**
+         *  \brief Same as send(), except \a news is moved into the queue.
+         */
+        int send(SrNews &&news);
         /**
          *  \brief Enter the agent loop.
          *
@@ -126,17 +150,46 @@ public:
          *  \note This function does not return.
          */
         void loop();
+        /**
+         *  \brief Enter the event-driven agent loop.
+         *
+         *  Same as loop(), except the agent blocks on a single epoll set
+         *  instead of polling. The set contains the eventfd of the ingress
+         *  queue (see SrQueue::enableEvent), a timerfd armed to the nearest
+         *  SrTimer deadline, and all file descriptors added via
+         *  addFdHandler(). Messages and timers are therefore handled as soon
+         *  as they are due, and an idle agent consumes no CPU at all.
+         *
+         *  \note This function does not return on success.
+         *  \return -1 if the epoll set cannot be created.
+         */
+        int eventLoop();
+        /**
+         *  \brief Add a file descriptor handler to the agent. Non thread-safe.
+         *
+         *  The handler is called from within eventLoop() whenever \a fd is
+         *  ready for \a events, loop() never calls it. Registering a new
+         *  handler for the same fd overwrites the old one. NULL removes the
+         *  fd from the agent, which must be done before the fd is closed.
+         *
+         *  \param fd the file descriptor to watch.
+         *  \param h pointer to an SrFdHandler instance.
+         *  \param events epoll events to watch, defaults to EPOLLIN.
+         *  \return 0 on success, -1 otherwise.
+         */
+        int addFdHandler(int fd, SrFdHandler *h, uint32_t events = EPOLLIN);
         /**
          *  \brief Add an SrTimer timer to the agent. Non thread-safe.
          *
-         *  \note This function does not start the timer, you have to start
-         *  the timer first.
-         *  \note This function also does no existence check, adding the same
-         *  timer multiple times results in the timer being added multiple times.
+         *  \note This function does not start the timer, the timer can be
+         *  started either before or after it is added.
+         *  \note Adding the same timer multiple times has no further effect.
+         *  Once added, the timer must be started and stopped within the agent
+         *  thread only.
          *
          *  \param timer reference to an SrTimer to add to the agent.
          */
-        void addTimer(SrTimer &timer) {timers.push_back(&timer);}
+        void addTimer(SrTimer &timer) {timers.add(timer);}
         /**
          *  \brief Add a message handler to the agent. Non thread-safe.
          *
@@ -147,7 +200,7 @@ public:
          *  \param functor pointer to a message handler.
          */
         void addMsgHandler(MsgID msgid, SrMsgHandler *functor) {
-                handlers[msgid] = functor;
+                handlers.set(msgid, functor);
         }
         /**
          *  \brief Add a message handler to the agent. Non thread-safe.
@@ -164,7 +217,7 @@ public:
          *  \param f Pointer to an SrMsgHandler instance.
          */
         void addXMsgHandler(MsgXID msgxid, MsgID msgid, SrMsgHandler *f) {
-                sh[XMsgID(msgxid, msgid)] = f;
+                sh.set(msgxid, msgid, f);
         }
 
 public:
@@ -174,19 +227,27 @@ public:
         SrQueue<SrOpBatch> ingress;
         /**
          *  \brief Outgoing queue for sending SmartREST requests.
+         *
+         *  Both queues are unbounded by default. On memory constrained
+         *  devices, bound them with SrQueue::setCapacity(), so requests do
+         *  not pile up while the SrReporter is retrying a failed send.
          */
         SrQueue<SrNews> egress;
 
 private:
-        void processMessages();
+        void processMessages(int millisec);
+        void processTimers();
 
 private:
-        typedef std::map<MsgID, SrMsgHandler*> _Handler;
-        typedef std::pair<MsgXID, MsgID> XMsgID;
-        typedef std::map<XMsgID, SrMsgHandler*> _XHandler;
-        typedef std::vector<SrTimer*> _Timer;
-        typedef _Timer::iterator _TimerIter;
-        _Timer timers;
+        typedef SrMsgTable<SrMsgHandler> _Handler;
+        typedef SrXMsgTable<SrMsgHandler> _XHandler;
+        SrTimerQueue timers;
+        std::vector<SrTimer*> due;
+        std::vector<SrFdHandler*> fds;
+        int epfd;
+        int tfd;
+        SmartRest parser;
+        SrRecord rec;
         _Handler handlers;
         _XHandler sh;
         string _tenant;
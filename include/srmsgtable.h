@@ -0,0 +1,115 @@
+#ifndef SRMSGTABLE_H
+#define SRMSGTABLE_H
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  \class SrMsgTable
+ *  \brief Direct-indexed lookup table from a message ID to its handler.
+ *
+ *  A message ID is a 16-bit integer, hence the handler is found with a
+ *  single array access, no tree walk nor hashing. The table grows to the
+ *  largest registered message ID.
+ */
+template<typename T> class SrMsgTable
+{
+public:
+        /**
+         *  \brief Find the handler for message \a id.
+         *  \return the registered handler, NULL if none.
+         */
+        T *find(uint16_t id) const {return id < tab.size() ? tab[id] : NULL;}
+        /**
+         *  \brief Register \a p for message \a id. NULL clears the handler.
+         */
+        void set(uint16_t id, T *p) {
+                if (id >= tab.size()) {
+                        if (p == NULL) return;
+                        tab.resize(id + 1, NULL);
+                }
+                tab[id] = p;
+        }
+
+private:
+        std::vector<T*> tab;
+};
+
+
+/**
+ *  \class SrXMsgTable
+ *  \brief Open addressing hash table from (XID, message ID) to its handler.
+ *
+ *  Both parts are packed into one 48-bit key, collisions are resolved by
+ *  linear probing, and the load factor is kept below 1/2. Clearing a handler
+ *  keeps its slot, so no deletion marker is required.
+ */
+template<typename T> class SrXMsgTable
+{
+public:
+        SrXMsgTable(): num(0) {}
+        /**
+         *  \brief Find the handler for message \a id of template \a xid.
+         *  \return the registered handler, NULL if none.
+         */
+        T *find(uint32_t xid, uint16_t id) const {
+                if (slots.empty()) return NULL;
+                const uint64_t k = key(xid, id);
+                const size_t mask = slots.size() - 1;
+                for (size_t i = hash(k, mask);; i = (i + 1) & mask) {
+                        if (slots[i].key == k) return slots[i].val;
+                        if (slots[i].key == _EMPTY) return NULL;
+                }
+        }
+        /**
+         *  \brief Register \a p for message \a id of template \a xid. NULL
+         *  clears the handler.
+         */
+        void set(uint32_t xid, uint16_t id, T *p) {
+                if ((num + 1) * 2 > slots.size())
+                        rehash(slots.empty() ? 16 : slots.size() * 2);
+                insert(key(xid, id), p);
+        }
+
+private:
+        static const uint64_t _EMPTY = ~(uint64_t)0;
+        struct _Slot {
+                uint64_t key;
+                T *val;
+        };
+        static uint64_t key(uint32_t xid, uint16_t id) {
+                return (uint64_t)xid << 16 | id;
+        }
+        static size_t hash(uint64_t k, size_t mask) {
+                return (k * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+        }
+        void insert(uint64_t k, T *p) {
+                const size_t mask = slots.size() - 1;
+                size_t i = hash(k, mask);
+                for (; slots[i].key != k; i = (i + 1) & mask) {
+                        if (slots[i].key == _EMPTY) {
+                                slots[i].key = k;
+                                ++num;
+                                break;
+                        }
+                }
+                slots[i].val = p;
+        }
+        void rehash(size_t cap) {
+                std::vector<_Slot> old(cap);
+                old.swap(slots);
+                for (size_t i = 0; i < slots.size(); ++i) {
+                        slots[i].key = _EMPTY;
+                        slots[i].val = NULL;
+                }
+                num = 0;
+                for (size_t i = 0; i < old.size(); ++i)
+                        if (old[i].key != _EMPTY)
+                                insert(old[i].key, old[i].val);
+        }
+
+        std::vector<_Slot> slots;
+        size_t num;
+};
+
+#endif /* SRMSGTABLE_H */
@@ -2,6 +2,7 @@
 #define SRNETMQTT_H
 #include <string>
 #include <algorithm>
+#include <memory>
 #include <vector>
 #include "../ext/pahomqtt/MQTTPacket/src/MQTTPacket.h"
 #include "srnetsocket.h"
@@ -36,9 +37,45 @@ struct SrMqttAppMsg
 };
 
 
+/**
+ *  \class SrMqttAppView
+ *  \brief View of an MQTT application message in the receive buffer.
+ *
+ *  The view is only valid during the SrMqttAppMsgHandler callback, copy the
+ *  topic and data if they are needed afterwards.
+ */
+struct SrMqttAppView
+{
+        /**
+         *  \brief SrMqttAppView constructor.
+         *
+         *  \param t topic name, \a tl bytes long.
+         *  \param d application message data, \a dl bytes long.
+         */
+        SrMqttAppView(const char *t, size_t tl, const char *d, size_t dl):
+                topic(t), tlen(tl), data(d), dlen(dl) {}
+        /**
+         *  \brief Topic name, not NUL-terminated.
+         */
+        const char *topic;
+        /**
+         *  \brief Length of the topic name.
+         */
+        size_t tlen;
+        /**
+         *  \brief Payload data, not NUL-terminated.
+         */
+        const char *data;
+        /**
+         *  \brief Length of the payload data.
+         */
+        size_t dlen;
+};
+
+
 /**
  *  \class SrMqttAppMsgHandler
- *  \brief Virtual abstract functor for SrMqttAppMsg callback handler.
+ *  \brief Virtual functor for SrMqttAppMsg callback handler.
  */
 class SrMqttAppMsgHandler
 {
@@ -52,15 +89,31 @@ public:
          *  \brief Callback function to be invoked when data received from
          *  registered message topic.
          *
-         *  This is an abstract virtual function. For use, subclass
-         *  SrMqttAppMsgHandler and implement your own version of operator().
+         *  For use, subclass SrMqttAppMsgHandler and implement your own
+         *  version of either operator().
          *
          *  \param appmsg received MQTT application message.
          */
-        virtual void operator()(const SrMqttAppMsg &appmsg) = 0;
+        virtual void operator()(const SrMqttAppMsg &appmsg) {(void)appmsg;}
+        /**
+         *  \brief Callback function to be invoked when data received from
+         *  registered message topic, without copying the message.
+         *
+         *  The default implementation copies the message into a
+         *  SrMqttAppMsg and invokes operator()(const SrMqttAppMsg&).
+         *
+         *  \param view received MQTT application message, only valid
+         *  during the call.
+         */
+        virtual void operator()(const SrMqttAppView &view) {
+                (*this)(SrMqttAppMsg(std::string(view.topic, view.tlen),
+                                     std::string(view.data, view.dlen)));
+        }
 };
 
 
+class _TopicTrie;
+
 /**
  *  \class SrNetMqtt
  *  \brief Generic MQTT network stack implementation.
@@ -69,8 +122,10 @@ public:
  *  (http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/mqtt-v3.1.1.html). It
  *  supports both plain MQTT and MQTT + TLS.
  *
- *  \note Currently only QoS level 0 and 1 are implemented, QoS 2 is not yet
- *  supported for both PUBLISH and SUBSCRIBE.
+ *  Publishes of QoS 1 and 2 are kept in an inflight table until the PUBACK,
+ *  or the PUBREC, PUBREL and PUBCOMP exchange completes. Received QoS 2
+ *  messages are delivered once, even if the server sends them again before
+ *  releasing them.
  */
 class SrNetMqtt: public SrNetSocket
 {
@@ -90,7 +145,7 @@ public:
          *  http/https. Hence, you must specify the correct port number.
          */
         SrNetMqtt(const string &clientid, const string &server);
-        virtual ~SrNetMqtt() {}
+        virtual ~SrNetMqtt();
         /**
          *  \brief Establish connection to a MQTT server.
          *
@@ -106,12 +161,79 @@ public:
         /**
          *  \brief Publish message \a msg to topic \a topic.
          *
+         *  For QoS 1 and 2, the method waits up to timeout() seconds for
+         *  the acknowledgement of this publish. Other packets received in
+         *  the meantime are handled as in yield(). Called from within a
+         *  SrMqttAppMsgHandler, the method does not wait, the publish
+         *  stays inflight() until a later yield() receives its
+         *  acknowledgement.
+         *
          *  \param topic topic name to be published to.
          *  \param msg application message for publishing.
          *  \param hflag nibble flag in MQTT fixed header.
          *  \return 0 on success, -1 on failure.
          */
         int publish(const string &topic, const string &msg, char hflag = 0);
+        /**
+         *  \brief Publish message \a msg to topic \a topic without waiting
+         *  for the acknowledgement.
+         *
+         *  For QoS 1 and 2, the packet is recorded as in flight until
+         *  yield() receives the matching PUBACK or PUBCOMP. This allows
+         *  many publishes to be outstanding at the same time, instead of
+         *  one per round trip. A QoS 2 retransmission after the PUBREC
+         *  sends the PUBREL instead of the message again.
+         *
+         *  The packet is queued and written together with other queued
+         *  packets by the next flush(), which yield() and publish() call.
+         *  A large queue is flushed right away.
+         *
+         *  \param topic topic name to be published to.
+         *  \param msg application message for publishing.
+         *  \param hflag nibble flag in MQTT fixed header.
+         *  \param packet packet identifier of a retransmission, set the DUP
+         *  bit in \a hflag accordingly. 0 allocates a new packet identifier.
+         *  \return packet identifier, 0 for QoS 0, -1 on failure, also when
+         *  all packet identifiers are in flight.
+         */
+        int publishAsync(const string &topic, const string &msg,
+                         char hflag = 2, uint16_t packet = 0);
+        /**
+         *  \brief Write all queued packets to the server at once.
+         *
+         *  \return 0 on success, -1 on failure. The queue is emptied in both
+         *  cases.
+         */
+        int flush();
+        /**
+         *  \brief Get the number of publishes still waiting for PUBACK or
+         *  PUBCOMP.
+         */
+        size_t inflight() const {return pending.size();}
+        /**
+         *  \brief Check if publish \a packet is still waiting for PUBACK or
+         *  PUBCOMP.
+         */
+        bool isInflight(uint16_t packet) const {
+                return find(pending.begin(), pending.end(), packet) !=
+                        pending.end();
+        }
+        /**
+         *  \brief Check if QoS 2 publish \a packet got its PUBREC, and only
+         *  waits for PUBCOMP.
+         */
+        bool isReleased(uint16_t packet) const {
+                return find(released.begin(), released.end(), packet) !=
+                        released.end();
+        }
+        /**
+         *  \brief Forget all publishes in flight, e.g., when giving up on
+         *  them after a broken connection.
+         */
+        void clearInflight() {
+                pending.clear();
+                released.clear();
+        }
         /**
          *  \brief Subscribe to topic filter \a topic with QoS level \a qos.
          *
@@ -201,36 +323,34 @@ public:
          *  In addition, it checks for the keep-alive interval expiration, and
          *  will ping() the server by sending MQTT PINGREQ control packet.
          *
-         *  \param ms recv() timeout in milliseconds.
+         *  Received bytes are decoded in place, a packet split across reads
+         *  stays in the receive buffer until it is complete. Only the first
+         *  read waits, the following ones drain what is already available.
+         *
+         *  \param ms recv() timeout in milliseconds, 0 only handles what is
+         *  already received, e.g., when the socket() is watched by an event
+         *  loop.
          *  \return 0 on success, -1 on failure.
          *
          *  \note The method returns 0 if recv() timed out. -1 indicates a
          *  network error, e.g., broken connection.
-         *
-         *  \note Because of current implementation limit, timeout \a ms
-         *  has only second resolution. For example, both 200 ms and 1234 ms
-         *  will be rounded to 1 second.
          */
         int yield(int ms);
         /**
-         *  \brief Add application message handler \a mh to topic \a t.
+         *  \brief Add application message handler \a mh to topic filter
+         *  \a t.
          *
          *  The added SrMqttMsgHandler \a mh will be invoked automatically
          *  the next time yield() is called after server published an
-         *  application message to the corresponding topic \a t.
+         *  application message to a topic matching \a t. A filter can have
+         *  multiple handlers, and a handler is invoked once per message,
+         *  even if it is added to several matching filters.
          *
-         *  \param t topic name. Wildcard filters are not supported.
+         *  \param t topic filter, may contain the wildcards '+' and '#'.
          *  \param mh SrMqttAppMsgHandler subclass instance. NULL to clear
-         *  an existing handler.
-         *  \return return type
-         */
-        void addMsgHandler(const string &t, SrMqttAppMsgHandler *mh) {
-                auto pred = [](const string &lhs, const _Item &rhs) {
-                        return lhs < rhs.first;
-                };
-                const auto it = upper_bound(hdls.begin(), hdls.end(), t, pred);
-                hdls.insert(it, make_pair(t, mh));
-        }
+         *  all handlers of \a t.
+         */
+        void addMsgHandler(const string &t, SrMqttAppMsgHandler *mh);
         /**
          *  \brief Set username for MQTT CONNECT packet.
          *
@@ -284,8 +404,21 @@ public:
          */
         int keepalive() const {return pval;}
 private:
-        typedef std::pair<string, SrMqttAppMsgHandler*> _Item;
-        std::vector<_Item> hdls;
+        void rxReserve(size_t n);
+        int receive(int ms);
+        void decode();
+        void complete(uint16_t packet);
+        void dispatch(const unsigned char *p, size_t hlen, size_t len);
+
+        std::unique_ptr<_TopicTrie> router;
+        std::vector<SrMqttAppMsgHandler*> hits; // handlers of a message
+        std::vector<char> rx;           // receive buffer
+        string txq;                     // packets queued for flush()
+        size_t rbeg, rend;              // undecoded bytes [rbeg, rend)
+        bool busy;                      // a handler is running
+        std::vector<uint16_t> pending;  // publishes in flight
+        std::vector<uint16_t> released; // of them, PUBREL sent
+        std::vector<uint16_t> received; // QoS 2 messages before PUBREL
         string client;
         string user;
         string pass;
@@ -293,6 +426,7 @@ private:
         string wmsg;
         struct timespec t0;
         uint16_t pval;
+        uint16_t pid;
         uint8_t wqos;
         bool iswill;
         bool wretain;
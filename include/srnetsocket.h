@@ -19,7 +19,7 @@ public:
          *  \param server Cumulocity server URL.
          */
         SrNetSocket(const string &server);
-        virtual ~SrNetSocket() {}
+        virtual ~SrNetSocket();
 
         /**
          *  \brief Establish a new connection.
@@ -34,6 +34,19 @@ public:
          *  or even 0, -1 on failure.
          */
         int sendBuf(const char *buf, size_t len);
+        /**
+         *  \brief Send the whole buffer.
+         *
+         *  Unlike sendBuf(), the data is written first, and the method only
+         *  waits for the socket when it would block, up to timeout() seconds
+         *  in total. With TLS, a buffer up to the maximum record size is
+         *  sent as a single record.
+         *
+         *  \param buf pointer to the send buffer.
+         *  \param len size of the send buffer.
+         *  \return \a len on success, -1 on failure.
+         */
+        int sendAll(const char *buf, size_t len);
         /**
          *  \brief Socket send method.
          *  \param request request to be sent.
@@ -52,9 +65,38 @@ public:
          *  signals a network error.
          */
         int recv(size_t len);
+        /**
+         *  \brief Socket recv method into a caller provided buffer.
+         *  \param buf pointer to the receive buffer.
+         *  \param len size of the receive buffer.
+         *  \param ms milliseconds to wait for data, 0 only takes what is
+         *  already available, negative waits up to timeout().
+         *  \return number of bytes received on success, -1 on failure.
+         *
+         *  \note Same as \a recv(), check errNo == CURLE_AGAIN if -1 is
+         *  returned.
+         */
+        int recvBuf(char *buf, size_t len, int ms = -1);
+        /**
+         *  \brief Get the socket of the established connection.
+         *
+         *  Send and receive only wait for the socket when an operation would
+         *  block, on an epoll set registered once per connection. To serve
+         *  many connections from one thread, watch their sockets in a shared
+         *  event loop instead, e.g., with SrAgent::addFdHandler(), and call
+         *  the non-waiting SrNetMqtt::yield(0) when one is readable. Watch
+         *  them level-triggered, a single call may leave data behind.
+         *
+         *  \return socket file descriptor, -1 if never connected.
+         */
+        int socket() const {return fd;}
 
 private:
+        int waitReady(int ms);
+
         const std::string _server;
+        int fd;                 // socket of the connection
+        int epfd;               // epoll set watching fd
 };
 
 #endif /* SRNETSOCKET_H */
@@ -1,11 +1,14 @@
 #ifndef SRQUEUE_H
 #define SRQUEUE_H
-#include <queue>
-#include <string.h>
+#include <deque>
+#include <vector>
+#include <utility>
+#include <errno.h>
 #include <time.h>
-#include <sys/time.h>
+#include <unistd.h>
+#include <stdint.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sys/eventfd.h>
 
 /**
  *  \class SrQueue
@@ -13,7 +16,17 @@
  *
  *  SrQueue is a consumer/producer queue for multi-thread communication.
  *  It uses the mutex facility from pthread to implement atomic get and
- *  put operations, and semaphore to avoid busy waiting.
+ *  put operations, and a condition variable to avoid busy waiting.
+ *  Elements are moved in and out of the queue whenever possible, and the
+ *  batch operations putMany() and drain() transfer many elements with a
+ *  single lock acquisition and wakeup.
+ *
+ *  By default the queue is unbounded. With a capacity set, the queue never
+ *  holds more than capacity elements, and a put into a full queue is
+ *  resolved by the overflow Policy: block the producer until there is
+ *  space, drop the oldest element, drop the new element, or coalesce the
+ *  new element with a queued element of the same key. The number of
+ *  dropped and blocked puts are counted for monitoring.
  */
 template<typename T> class SrQueue
 {
@@ -30,94 +43,245 @@ public:
          *  thus element T requires a default constructor.
          */
         typedef std::pair<T, ErrCode> Event;
-        SrQueue(): q() {
-                mutex = PTHREAD_MUTEX_INITIALIZER;
-                memset(&sem, 0, sizeof(sem));
-                sem_init(&sem, 0, 0);
+        /**
+         *  \brief Overflow policy of a bounded queue.
+         *
+         *  Q_BLOCK: put blocks until the consumer makes space.
+         *  Q_DROP_OLDEST: the oldest queued element is discarded.
+         *  Q_DROP_NEWEST: the new element is discarded, put returns -1.
+         *  Q_COALESCE: the new element replaces the newest queued element
+         *  with the same key, keeping its position in the queue. When no
+         *  such element exists, falls back to Q_DROP_OLDEST.
+         */
+        enum Policy {Q_BLOCK = 0, Q_DROP_OLDEST, Q_DROP_NEWEST, Q_COALESCE};
+        /**
+         *  \brief Key comparison for Q_COALESCE, returns true when the two
+         *  elements have the same key.
+         */
+        typedef bool (*SameKey)(const T&, const T&);
+        /**
+         *  \brief SrQueue constructor.
+         *
+         *  \param capacity maximum number of elements, 0 means unbounded.
+         *  \param policy overflow policy when the queue is full.
+         *  \param same key comparison, only used by Q_COALESCE.
+         */
+        SrQueue(size_t capacity = 0, Policy policy = Q_BLOCK,
+                SameKey same = NULL): q(), cap(capacity), pol(policy),
+                                      same(same), ndrop(0), nblock(0),
+                                      waiting(0), efd(-1) {
+                pthread_mutex_init(&mutex, NULL);
+                pthread_condattr_t attr;
+                pthread_condattr_init(&attr);
+                pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+                pthread_cond_init(&cond, &attr);
+                pthread_cond_init(&space, &attr);
+                pthread_condattr_destroy(&attr);
         }
         virtual ~SrQueue() {
-                sem_destroy(&sem);
+                if (efd != -1) close(efd);
+                pthread_cond_destroy(&space);
+                pthread_cond_destroy(&cond);
                 pthread_mutex_destroy(&mutex);
         }
         /**
-         *  \brief get an element from the queue.
+         *  \brief Set the capacity and overflow policy of the queue.
          *
-         *  This a blocking call, it never returns until the underlying semaphore
-         *  signals that there is at least one element available in the queue.
-         *  \note You must still check the error code after this function
-         *  returns, as the mutex locking may fail, or another thread may have
-         *  retrieved the element first.
+         *  Elements already queued beyond the new capacity are kept, the
+         *  policy applies to subsequent puts only. Producers blocked on a
+         *  full queue are woken up to re-check the new capacity.
          *
-         *  \return the element T with error code.
+         *  \param capacity maximum number of elements, 0 means unbounded.
+         *  \param policy overflow policy when the queue is full.
+         *  \param same key comparison, only used by Q_COALESCE.
          */
-        Event get() {
-                sem_wait(&sem);
-                Event e;
+        void setCapacity(size_t capacity, Policy policy = Q_BLOCK,
+                         SameKey same = NULL) {
                 if (pthread_mutex_lock(&mutex) == 0) {
-                        if (q.empty()) {
-                                q.second = Q_EMPTY;
-                        } else {
-                                e = std::make_pair(q.front(), Q_OK);
-                                q.pop();
-                        }
+                        cap = capacity;
+                        pol = policy;
+                        this->same = same;
+                        pthread_cond_broadcast(&space);
                         pthread_mutex_unlock(&mutex);
-                } else {
-                        e.second = Q_BUSY;
                 }
-                return e;
         }
+        /**
+         *  \brief Get the capacity of the queue, 0 means unbounded.
+         */
+        size_t capacity() const {return cap;}
+        /**
+         *  \brief Get the overflow policy of the queue.
+         */
+        Policy policy() const {return pol;}
+        /**
+         *  \brief Number of elements discarded or coalesced due to overflow.
+         *
+         *  \note This function is not thread-safe, it should only be used as a
+         *  hint rather than an accurate measure.
+         */
+        uint64_t dropped() const {return ndrop;}
+        /**
+         *  \brief Number of puts that blocked on a full queue.
+         *
+         *  \note This function is not thread-safe, it should only be used as a
+         *  hint rather than an accurate measure.
+         */
+        uint64_t blocked() const {return nblock;}
+        /**
+         *  \brief Enable event notification for the queue.
+         *
+         *  After this call, every put() additionally signals an eventfd, which
+         *  can be waited for with poll, select or epoll along with other file
+         *  descriptors. The eventfd is non-blocking, the consumer reads it
+         *  to reset the notification, and then gets all available elements.
+         *  Calling this function multiple times returns the same eventfd.
+         *
+         *  \return the eventfd, -1 on failure.
+         */
+        int enableEvent() {
+                int fd = -1;
+                if (pthread_mutex_lock(&mutex) == 0) {
+                        if (efd == -1)
+                                efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                        fd = efd;
+                        pthread_mutex_unlock(&mutex);
+                }
+                return fd;
+        }
+        /**
+         *  \brief Get the eventfd of the queue, -1 if not enabled.
+         */
+        int eventFd() const {return efd;}
+        /**
+         *  \brief get an element from the queue.
+         *
+         *  This a blocking call, it never returns until there is at least one
+         *  element available in the queue. The element is moved out of the
+         *  queue.
+         *  \note You must still check the error code after this function
+         *  returns, as the mutex locking may fail.
+         *
+         *  \return the element T with error code.
+         */
+        Event get() {return get(-1);}
         /**
          *  \brief get an element from the queue.
          *
          *  Similar to the get function with no parameter, except this function
          *  waits at most millisec milliseconds instead of waiting forever. This
-         *  function can fail additionally when timed out. Calling this function
-         *  with negative value causes undefined behavior.
+         *  function can fail additionally when timed out. A negative value
+         *  waits forever.
          *
          *  \return the element T with error code.
          */
         Event get(int millisec) {
-                timeval tv = {0, 0};
-                gettimeofday(&tv, NULL);
-                timeval delta = {millisec/1000, (millisec%1000)*1000};
-                timeval res;
-                timeradd(&tv, &delta, &res);
-                const timespec tp = {res.tv_sec, res.tv_usec * 1000};
                 Event e;
-                // Testing for q.empty() is because for some version of
-                // sem_timedwait could timeout and return with -1 while
-                // sem_getvalue() is actual non-0.
-                if (sem_timedwait(&sem, &tp) == -1 && q.empty()) {
-                        e.second = Q_TIMEOUT;
+                if (pthread_mutex_lock(&mutex) != 0) {
+                        e.second = Q_BUSY;
                         return e;
                 }
-                if (pthread_mutex_trylock(&mutex) == 0) {
-                        if (q.empty()) {
-                                e.second = Q_EMPTY;
-                        } else {
-                                e = std::make_pair(q.front(), Q_OK);
-                                q.pop();
-                        }
-                        pthread_mutex_unlock(&mutex);
+                if (wait(millisec)) {
+                        e.first = std::move(q.front());
+                        q.pop_front();
+                        if (waiting)
+                                pthread_cond_signal(&space);
+                        e.second = Q_OK;
                 } else {
-                        e.second = Q_BUSY;
+                        e.second = Q_TIMEOUT;
                 }
+                pthread_mutex_unlock(&mutex);
                 return e;
         }
+        /**
+         *  \brief get up to \a max elements from the queue at once.
+         *
+         *  Waits at most millisec milliseconds for the first element, then
+         *  moves all available elements, but no more than \a max, to the
+         *  end of \a items without waiting any further. A negative value
+         *  waits forever.
+         *
+         *  \param items vector to append the elements to.
+         *  \param max maximum number of elements to get.
+         *  \param millisec maximum waiting time in milliseconds.
+         *  \return number of elements appended, 0 on timeout or failure.
+         */
+        size_t drain(std::vector<T> &items, size_t max, int millisec) {
+                if (max == 0 || pthread_mutex_lock(&mutex) != 0)
+                        return 0;
+                size_t n = 0;
+                if (wait(millisec)) {
+                        for (; n < max && !q.empty(); ++n) {
+                                items.push_back(std::move(q.front()));
+                                q.pop_front();
+                        }
+                        if (waiting)
+                                pthread_cond_broadcast(&space);
+                }
+                pthread_mutex_unlock(&mutex);
+                return n;
+        }
         /**
          *  \brief put element item into the queue.
          *
+         *  When the queue is full, the overflow policy applies, and this
+         *  function may block with Q_BLOCK.
+         *
          *  \param item the element to put into the queue.
+         *  \return 0 on success, -1 on failure or dropped by Q_DROP_NEWEST.
+         */
+        int put(const T& item) {return emplace(item);}
+        /**
+         *  \brief put element item into the queue, without copying it.
+         *
+         *  \param item the element to move into the queue.
+         *  \return 0 on success, -1 on failure or dropped by Q_DROP_NEWEST.
+         */
+        int put(T&& item) {return emplace(std::move(item));}
+        /**
+         *  \brief construct an element in place at the end of the queue.
+         *
+         *  \param args arguments forwarded to the constructor of T.
+         *  \return 0 on success, -1 on failure or dropped by Q_DROP_NEWEST.
+         */
+        template<typename... Args> int emplace(Args&&... args) {
+                if (pthread_mutex_lock(&mutex) != 0)
+                        return -1;
+                int c = 0;
+                if (full())
+                        c = overflow(T(std::forward<Args>(args)...));
+                else
+                        q.emplace_back(std::forward<Args>(args)...);
+                pthread_cond_signal(&cond);
+                notify();
+                return c;
+        }
+        /**
+         *  \brief put all elements of \a items into the queue at once.
+         *
+         *  The elements are moved into the queue in order, with a single lock
+         *  acquisition and a single wakeup of the waiting consumers. \a items
+         *  is cleared on success. The overflow policy applies to each element
+         *  individually, with Q_BLOCK the lock is released while waiting for
+         *  space.
+         *
+         *  \param items the elements to move into the queue.
          *  \return 0 on success, -1 otherwise.
          */
-        int put(const T& item) {
-                if (pthread_mutex_lock(&mutex) == 0) {
-                        q.push(item);
-                        pthread_mutex_unlock(&mutex);
-                        sem_post(&sem);
+        int putMany(std::vector<T>&& items) {
+                if (items.empty())
                         return 0;
+                if (pthread_mutex_lock(&mutex) != 0)
+                        return -1;
+                for (size_t i = 0; i < items.size(); ++i) {
+                        if (full())
+                                overflow(std::move(items[i]));
+                        else
+                                q.push_back(std::move(items[i]));
                 }
-                return -1;
+                pthread_cond_broadcast(&cond);
+                notify();
+                items.clear();
+                return 0;
         }
         /**
          *  \brief get the number of elements in the queue.
@@ -138,9 +302,91 @@ public:
          */
         bool empty() const {return q.empty();}
 private:
-        std::queue<T> q;
-        sem_t sem;
+        SrQueue(const SrQueue&);
+        SrQueue &operator=(const SrQueue&);
+        // Wait with the mutex locked until the queue is non-empty, or until
+        // millisec has elapsed. Returns true if the queue is non-empty.
+        bool wait(int millisec) {
+                if (millisec < 0) {
+                        while (q.empty())
+                                pthread_cond_wait(&cond, &mutex);
+                        return true;
+                }
+                if (q.empty() && millisec > 0) {
+                        timespec ts;
+                        clock_gettime(CLOCK_MONOTONIC, &ts);
+                        ts.tv_sec += millisec / 1000;
+                        ts.tv_nsec += (millisec % 1000) * 1000000;
+                        if (ts.tv_nsec >= 1000000000) {
+                                ++ts.tv_sec;
+                                ts.tv_nsec -= 1000000000;
+                        }
+                        while (q.empty() && pthread_cond_timedwait(
+                                       &cond, &mutex, &ts) != ETIMEDOUT);
+                }
+                return !q.empty();
+        }
+        bool full() const {return cap && q.size() >= cap;}
+        // Put item into the full queue according to the overflow policy,
+        // with the mutex locked. Returns -1 if item is dropped.
+        int overflow(T &&item) {
+                switch (pol) {
+                case Q_BLOCK:
+                        // the consumer must see the queued elements before
+                        // it can make space, e.g. in the middle of putMany.
+                        pthread_cond_broadcast(&cond);
+                        kick(efd);
+                        ++nblock;
+                        ++waiting;
+                        while (full())
+                                pthread_cond_wait(&space, &mutex);
+                        --waiting;
+                        break;
+                case Q_DROP_NEWEST:
+                        ++ndrop;
+                        return -1;
+                case Q_COALESCE:
+                        for (auto i = q.rbegin(); same && i != q.rend(); ++i) {
+                                if (same(*i, item)) {
+                                        *i = std::move(item);
+                                        ++ndrop;
+                                        return 0;
+                                }
+                        }
+                        // fall through
+                case Q_DROP_OLDEST:
+                        q.pop_front();
+                        ++ndrop;
+                        break;
+                }
+                q.push_back(std::move(item));
+                return 0;
+        }
+        // Unlock after a put, and signal the eventfd if enabled.
+        void notify() {
+                const int fd = efd;
+                pthread_mutex_unlock(&mutex);
+                kick(fd);
+        }
+        static void kick(int fd) {
+                if (fd != -1) {
+                        const uint64_t one = 1;
+                        ssize_t n = write(fd, &one, sizeof(one));
+                        (void)n; // fails only when already signaled
+                }
+        }
+
+        std::deque<T> q;
+        size_t cap;
+        Policy pol;
+        SameKey same;
+        uint64_t ndrop;
+        uint64_t nblock;
+        size_t waiting;
         pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        pthread_cond_t space;
+        int efd;
 };
 
 #endif /* SRQUEUE_H */
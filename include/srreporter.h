@@ -8,6 +8,7 @@
 #include "srlogger.h"
 
 #define SR_MQTTOPT_KEEPALIVE 1
+#define SR_MQTTOPT_INFLIGHT 2
 
 /**
  *  \class SrReporter
@@ -16,7 +17,8 @@
  *  The SrReporter is responsible for sending all requests (measurements,
  *  alarms, events, etc.) to Cumulocity. For traffic saving, the SrReporter
  *  implements request aggregation when there are consecutive requests in the
- *  queue within less than SR_REPORTER_VAL (default 400) milliseconds. It also
+ *  queue within SR_REPORTER_VAL (default 400) milliseconds, see
+ *  setBatchPolicy() for tuning at runtime. It also
  *  implements a multiple retry and exponential waiting mechanism for
  *  counteracting the instability of mobile networks. Additionally, it
  *  implements a capacity limited buffering technique for counteracting long
@@ -29,6 +31,7 @@
  *  not be lost in case of sudden outage.
  */
 class _Pager;
+class _Aggregator;
 
 class SrReporter
 {
@@ -53,7 +56,7 @@ public:
          */
         SrReporter(const string &server, const string &xid, const string &auth,
                    SrQueue<SrNews> &out, SrQueue<SrOpBatch> &in,
-                   uint16_t cap=1000, const string buffile = "");
+                   uint32_t cap=1000, const string buffile = "");
         /**
          *  \brief SrReporter MQTT constrcutor.
          *
@@ -78,16 +81,20 @@ public:
         SrReporter(const string &server, const string &deviceId,
                    const string &xid, const string &user, const string &pass,
                    SrQueue<SrNews> &out, SrQueue<SrOpBatch> &in,
-                   uint16_t cap=1000, const string buffile = "");
+                   uint32_t cap=1000, const string buffile = "");
         virtual ~SrReporter();
 
         /**
          *  \brief Get the current capacity of the request buffer.
          *
          *  capacity signifies the capacity of the underlying buffering
-         *  mechanism. For memory backed buffering, it signifies the number
-         *  of messages can be buffered. For file backed buffering, it
-         *  signifies the number of file pages available.
+         *  mechanism. For memory backed buffering, it signifies the memory
+         *  budget in units of 64 bytes, i.e., roughly the number of messages
+         *  can be buffered. For file backed buffering, it
+         *  signifies the number of file pages available. The pages are
+         *  stored in segment files of 65536 pages each, the first segment
+         *  is \a buffile itself, further ones are named \a buffile.1,
+         *  \a buffile.2, and so on.
          *
          *  Messages with SR_PRIO_BUF bit set will be buffered when the network
          *  is unavailable. However, when the network is down for longer time,
@@ -106,7 +113,7 @@ public:
          *  file backed buffering, page fragmentation will also waste a
          *  fraction of the capacity.
          */
-        uint16_t capacity() const;
+        uint32_t capacity() const;
         /**
          *  \brief Set the capacity of the request buffer.
          *
@@ -118,7 +125,43 @@ public:
          *
          *  \param cap new buffer capacity.
          */
-        void setCapacity(uint16_t cap);
+        void setCapacity(uint32_t cap);
+        /**
+         *  \brief Set the batching policy of request aggregation.
+         *
+         *  Consecutive requests are aggregated into one batch, which is sent
+         *  as soon as it reaches \a bytes or \a records, a request with the
+         *  SR_PRIO_FLUSH bit set is added, or its first request has waited
+         *  for \a linger milliseconds. Defaults to no byte limit,
+         *  SR_REPORTER_NUM records and SR_REPORTER_VAL milliseconds. The
+         *  policy can be changed at any time, and applies from the next batch.
+         *
+         *  \param bytes maximum size of a batch in bytes, 0 for no limit. A
+         *  single request larger than this is sent in a batch of its own.
+         *  \param records maximum number of requests in a batch.
+         *  \param linger maximum time in milliseconds a request waits for more
+         *  requests to join its batch, 0 sends what is immediately available.
+         */
+        void setBatchPolicy(size_t bytes, size_t records, int linger);
+        /**
+         *  \brief Compress buffered requests.
+         *
+         *  Requests buffered during network outage are compressed with
+         *  deflate, primed with dictionary \a dict. A good dictionary is
+         *  the registered SmartREST template, or a few typical requests.
+         *  For memory backed buffering, batches are compressed once full,
+         *  for file backed buffering, each buffered aggregated request is
+         *  compressed. The compressed size counts against the capacity, so
+         *  the buffer holds several times more requests. Call it before
+         *  start(). For file backed buffering, keep the dictionary the same
+         *  across restarts, requests compressed with another dictionary are
+         *  discarded.
+         *
+         *  \param dict preset dictionary, may be empty.
+         *  \return 0 on success, -1 if the library is built without
+         *  SR_BUF_COMPRESS.
+         */
+        int setCompression(const string &dict);
         /**
          *  \brief Start the SrReporter thread.
          *
@@ -155,6 +198,14 @@ public:
          *  Supported MQTT option list:
          *
          *  - SR_MQTTOPT_KEEPALIVE [E]: MQTT keepalive interval in seconds.
+         *  - SR_MQTTOPT_INFLIGHT [E]: maximum number of aggregated requests
+         *  published without waiting for their PUBACK, defaults to 1, at
+         *  most 4096, far below the number of MQTT packet identifiers. When
+         *  greater than 1, the SrReporter keeps publishing while earlier
+         *  requests are still in flight, so throughput is no longer limited
+         *  to one request per round trip. Requests in flight are re-published
+         *  in order after a re-connect. Only effective with memory backed
+         *  buffering, file backed buffering always waits for each PUBACK.
          *
          *  \param option various MQTT options.
          *  \param parameter value for corresponding MQTT option.
@@ -178,6 +229,8 @@ private:
         SrQueue<SrOpBatch> &in;
         const string &xid;
         std::unique_ptr<_Pager> ptr;
+        std::unique_ptr<_Aggregator> agg;
+        uint16_t window;
         bool sleeping;
         bool isfilebuf;
 };
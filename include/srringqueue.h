@@ -0,0 +1,211 @@
+#ifndef SRRINGQUEUE_H
+#define SRRINGQUEUE_H
+#include <atomic>
+#include <utility>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ *  \class SrRingQueue
+ *  \brief Bounded lock-free multi-producer/single-consumer queue.
+ *
+ *  SrRingQueue is a drop-in alternative to SrQueue with the same put() and
+ *  get() interface. Elements are stored in a pre-allocated ring, each slot
+ *  carries a sequence number, producers claim slots with a single CAS, hence
+ *  put() neither locks, allocates nor makes a system call. The consumer
+ *  parks on a futex only when the ring is empty, and producers only wake it
+ *  when it is actually parked.
+ *
+ *  \note Any number of threads may put(), but only one thread may get().
+ *  \note Unlike SrQueue, the queue is bounded, put() fails when it is full.
+ */
+template<typename T> class SrRingQueue
+{
+public:
+        /**
+         *  \brief Enumeration of all possible error code.
+         */
+        enum ErrCode {Q_OK = 0, Q_TIMEOUT, Q_BUSY, Q_EMPTY, Q_NOTIME};
+        /**
+         *  \brief Event wraps the element type and an error code.
+         *
+         *  The error code must be first checked before access the element T.
+         *  When the error code is not 0, element T is default constructed,
+         *  thus element T requires a default constructor.
+         */
+        typedef std::pair<T, ErrCode> Event;
+        /**
+         *  \brief SrRingQueue constructor.
+         *  \param capacity maximum number of elements, rounded up to the
+         *  next power of 2.
+         */
+        SrRingQueue(size_t capacity = 1024): head(0), tail(0), word(0),
+                                             parked(0) {
+                size_t cap = 2;
+                while (cap < capacity) cap <<= 1;
+                mask = cap - 1;
+                ring = new _Cell[cap];
+                for (size_t i = 0; i < cap; ++i)
+                        ring[i].seq.store(i, std::memory_order_relaxed);
+        }
+        virtual ~SrRingQueue() {delete[] ring;}
+        /**
+         *  \brief get an element from the queue.
+         *
+         *  This a blocking call, it never returns until there is at least one
+         *  element available in the queue.
+         *
+         *  \return the element T with error code.
+         */
+        Event get() {return get(-1);}
+        /**
+         *  \brief get an element from the queue.
+         *
+         *  Similar to the get function with no parameter, except this function
+         *  waits at most millisec milliseconds instead of waiting forever. A
+         *  negative value waits forever.
+         *
+         *  \return the element T with error code.
+         */
+        Event get(int millisec) {
+                Event e;
+                if (pop(e.first))
+                        return e;
+                timespec end = {0, 0};
+                if (millisec > 0) {
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        end.tv_sec += millisec / 1000;
+                        end.tv_nsec += (millisec % 1000) * 1000000;
+                        if (end.tv_nsec >= 1000000000) {
+                                ++end.tv_sec;
+                                end.tv_nsec -= 1000000000;
+                        }
+                }
+                while (millisec) {
+                        timespec ts, *pts = NULL;
+                        if (millisec > 0) {
+                                clock_gettime(CLOCK_MONOTONIC, &ts);
+                                ts.tv_sec = end.tv_sec - ts.tv_sec;
+                                ts.tv_nsec = end.tv_nsec - ts.tv_nsec;
+                                if (ts.tv_nsec < 0) {
+                                        --ts.tv_sec;
+                                        ts.tv_nsec += 1000000000;
+                                }
+                                if (ts.tv_sec < 0)
+                                        break;
+                                pts = &ts;
+                        }
+                        // announce parking before the last check, so either
+                        // the check sees the element, or the producer sees
+                        // the consumer parked and wakes it up.
+                        parked.store(1, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        const int w = word.load(std::memory_order_acquire);
+                        if (pop(e.first)) {
+                                parked.store(0, std::memory_order_relaxed);
+                                return e;
+                        }
+                        syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, w, pts,
+                                NULL, 0);
+                        parked.store(0, std::memory_order_relaxed);
+                        if (pop(e.first))
+                                return e;
+                }
+                e.second = Q_TIMEOUT;
+                return e;
+        }
+        /**
+         *  \brief put element item into the queue.
+         *
+         *  \param item the element to put into the queue.
+         *  \return 0 on success, -1 if the queue is full.
+         */
+        int put(const T &item) {
+                size_t pos = tail.load(std::memory_order_relaxed);
+                _Cell *c;
+                for (;;) {
+                        c = &ring[pos & mask];
+                        const size_t seq = c->seq.load(std::memory_order_acquire);
+                        const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                        if (diff == 0) {
+                                if (tail.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed))
+                                        break;
+                        } else if (diff < 0) {
+                                return -1;
+                        } else {
+                                pos = tail.load(std::memory_order_relaxed);
+                        }
+                }
+                c->data = item;
+                c->seq.store(pos + 1, std::memory_order_release);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // only the first producer wakes up the parked consumer
+                if (parked.load(std::memory_order_relaxed) &&
+                    parked.exchange(0, std::memory_order_relaxed)) {
+                        word.fetch_add(1, std::memory_order_release);
+                        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1,
+                                NULL, NULL, 0);
+                }
+                return 0;
+        }
+        /**
+         *  \brief get the number of elements in the queue.
+         *
+         *  \note This function should only be used as a hint rather than an
+         *  accurate measure.
+         *
+         *  \return the number of elements currently in the queue.
+         */
+        size_t size() const {
+                const size_t h = head.load(std::memory_order_relaxed);
+                const size_t t = tail.load(std::memory_order_relaxed);
+                return t > h ? t - h : 0;
+        }
+        /**
+         *  \brief check if the queue is empty.
+         *
+         *  \note This function should only be used as a hint rather than an
+         *  accurate measure.
+         *
+         *  \return true if the queue is empty, false otherwise.
+         */
+        bool empty() const {return size() == 0;}
+        /**
+         *  \brief Get the capacity of the queue.
+         */
+        size_t capacity() const {return mask + 1;}
+
+private:
+        SrRingQueue(const SrRingQueue&);
+        SrRingQueue &operator=(const SrRingQueue&);
+        struct _Cell {
+                std::atomic<size_t> seq;
+                T data;
+        };
+        bool pop(T &item) {
+                const size_t pos = head.load(std::memory_order_relaxed);
+                _Cell *c = &ring[pos & mask];
+                if (c->seq.load(std::memory_order_acquire) != pos + 1)
+                        return false;
+                item = std::move(c->data);
+                c->seq.store(pos + mask + 1, std::memory_order_release);
+                head.store(pos + 1, std::memory_order_relaxed);
+                return true;
+        }
+
+        // consumer and producer indices on separate cache lines
+        std::atomic<size_t> head;
+        char pad0[64];
+        std::atomic<size_t> tail;
+        char pad1[64];
+        std::atomic<int> word;
+        std::atomic<int> parked;
+        _Cell *ring;
+        size_t mask;
+};
+
+#endif /* SRRINGQUEUE_H */
@@ -1,11 +1,13 @@
 #ifndef SRTIMER_H
 #define SRTIMER_H
 #include <utility>
+#include <vector>
 #include <time.h>
 #include "srtypes.h"
 
 class SrTimer;
 class SrAgent;
+class SrTimerQueue;
 
 /**
  *  \brief Comparison operator for timespec.
@@ -49,8 +51,21 @@ public:
          *  \param callback functor to be executed when the timer fires.
          */
         SrTimer(int millisec, SrTimerHandler *callback = NULL):
-                cb(callback), val(millisec), active(false) {}
-        virtual ~SrTimer() {}
+                cb(callback), q(NULL), pos(-1), val(millisec), active(false) {}
+        /**
+         *  \brief SrTimer copy constructor.
+         *  \note The copy is not added to the agent of \a t.
+         */
+        SrTimer(const SrTimer &t): cb(t.cb), beg(t.beg), end(t.end), q(NULL),
+                                   pos(-1), val(t.val), active(t.active) {}
+        /**
+         *  \brief Destructor, the timer is removed from its SrAgent.
+         */
+        virtual ~SrTimer();
+        /**
+         *  \brief SrTimer assignment, the agent of the timer is unchanged.
+         */
+        SrTimer &operator=(const SrTimer &t);
 
         /**
          *  \brief Check if the timer is active.
@@ -102,27 +117,76 @@ public:
          *  This function activates the timer, sets the schedule time to now,
          *  and the fire time according to the current period.
          */
-        void start() {
-                clock_gettime(CLOCK_MONOTONIC_COARSE, &beg);
-                end.tv_sec = beg.tv_sec + val / 1000;
-                end.tv_nsec = beg.tv_nsec + (val % 1000) * 1000000;
-                if (end.tv_nsec >= 1000000000) {
-                        ++end.tv_sec;
-                        end.tv_nsec -= 1000000000;
-                }
-                active = true;
-        }
+        void start();
         /**
          *  \brief Stop the timer. Sets the timer to inactive.
          */
-        void stop() {active = false;}
+        void stop();
 
 private:
+        friend class SrTimerQueue;
         SrTimerHandler *cb;
         timespec beg;
         timespec end;
+        SrTimerQueue *q;
+        size_t pos;
         int val;
         bool active;
 };
 
+
+/**
+ *  \class SrTimerQueue
+ *  \brief Scheduling queue of timers, used internally by SrAgent.
+ *
+ *  Active timers are kept in a binary min-heap ordered by fire time, each
+ *  timer knows its position in the heap, so start() and stop() re-position
+ *  a single timer in O(log n). The nearest deadline is always at the top,
+ *  no timer is visited until it is due.
+ *  \note Non thread-safe, timers added to an agent must be started and
+ *  stopped within the agent thread only.
+ */
+class SrTimerQueue
+{
+public:
+        SrTimerQueue() {}
+        /**
+         *  \brief Destructor, all added timers are detached from the queue.
+         */
+        ~SrTimerQueue();
+        /**
+         *  \brief Add a timer, scheduled right away if active.
+         */
+        void add(SrTimer &timer);
+        /**
+         *  \brief Check if no timer is active.
+         */
+        bool empty() const {return heap.empty();}
+        /**
+         *  \brief Get the active timer with the nearest fire time.
+         *  \note Undefined behavior if the queue is empty.
+         */
+        SrTimer *top() const {return heap[0];}
+        /**
+         *  \brief Remove and return the timer at the top.
+         *
+         *  The timer stays active, it is scheduled again by start().
+         */
+        SrTimer *pop();
+
+private:
+        friend class SrTimer;
+        SrTimerQueue(const SrTimerQueue&);
+        SrTimerQueue &operator=(const SrTimerQueue&);
+        void schedule(SrTimer *t);
+        void remove(SrTimer *t);
+        void detach(SrTimer *t);
+        void up(size_t i);
+        void down(size_t i);
+        void place(size_t i, SrTimer *t) {heap[i] = t; t->pos = i;}
+
+        std::vector<SrTimer*> heap;
+        std::vector<SrTimer*> all;
+};
+
 #endif /* SRTIMER_H */
@@ -1,9 +1,12 @@
 #ifndef SRTYPES_H
 #define SRTYPES_H
 #include <string>
+#include <utility>
+#include <stdint.h>
 
 #define SR_PRIO_BUF 1
 #define SR_PRIO_XID 2
+#define SR_PRIO_FLUSH 4
 
 /**
  *  \class SrNews
@@ -28,6 +31,11 @@ struct SrNews
          *  \param prio assignment to member \a prio.
          */
         SrNews(const std::string &s, uint8_t prio = 0): data(s), prio(prio) {}
+        /**
+         *  \brief SrNews constructor, taking over the string \a s.
+         */
+        SrNews(std::string &&s, uint8_t prio = 0):
+                data(std::move(s)), prio(prio) {}
         /**
          *  \brief The request to send to Cumulocity.
          */
@@ -45,6 +53,9 @@ struct SrNews
          *  \a SR_PRIO_XID: request uses a different template XID than
          *  SrAgent.XID(), and the first field in the CSV is the alternate XID.
          *
+         *  \a SR_PRIO_FLUSH: request closes the batch it is aggregated into,
+         *  which is sent immediately instead of waiting for more requests.
+         *
          *  \note prio can be bit-wise XOR-ed, multiple priority can be set
          *  at the same time.
          */
@@ -71,6 +82,10 @@ struct SrOpBatch
          *  \param s string
          */
         SrOpBatch(const std::string &s): data(s) {}
+        /**
+         *  \brief SrOpBatch constructor, taking over the string \a s.
+         */
+        SrOpBatch(std::string &&s): data(std::move(s)) {}
         /**
          *  \brief Buffer contains the response.
          */
@@ -1,74 +1,401 @@
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SR_LEX_X86
+#endif
 #include "smartrest.h"
 using namespace std;
 
+/*
+ * Structural index of the lexer: one bitmask per class for each 64 bytes of
+ * the buffer, bit i set when byte i of the block belongs to the class.
+ */
+enum {
+        IDX_QUOTE,      // "
+        IDX_DELIM,      // , or newline
+        IDX_SKIP,       // garbage before a value, i.e., !isgraph except newline
+        IDX_STOP,       // end of an unquoted value, !isprint or , or "
+        IDX_DIGIT,      // 0-9
+        IDX_DOT,        // .
+        IDX_NUM
+};
+
+typedef void (*_IndexFunc)(const char *s, size_t blocks, uint64_t *m);
+
+static inline void _classify(uint64_t *m, uint64_t q, uint64_t c, uint64_t nl,
+                             uint64_t sp, uint64_t pr, uint64_t dg, uint64_t dt)
+{
+        m[IDX_QUOTE] = q;
+        m[IDX_DELIM] = c | nl;
+        m[IDX_SKIP] = (~pr & ~nl) | sp;
+        m[IDX_STOP] = ~pr | c | q;
+        m[IDX_DIGIT] = dg;
+        m[IDX_DOT] = dt;
+}
+
+
+static void _indexScalar(const char *s, size_t blocks, uint64_t *m)
+{
+        for (size_t b = 0; b < blocks; ++b, s += 64, m += IDX_NUM) {
+                uint64_t q = 0, c = 0, nl = 0, sp = 0, pr = 0, dg = 0, dt = 0;
+                for (int i = 0; i < 64; ++i) {
+                        const unsigned char ch = s[i];
+                        const uint64_t bit = (uint64_t)1 << i;
+                        if (ch == '"') q |= bit;
+                        else if (ch == ',') c |= bit;
+                        else if (ch == '\n') nl |= bit;
+                        else if (ch == ' ') sp |= bit;
+                        else if (ch == '.') dt |= bit;
+                        else if (ch >= '0' && ch <= '9') dg |= bit;
+                        if (ch >= 0x20 && ch <= 0x7e) pr |= bit;
+                }
+                _classify(m, q, c, nl, sp, pr, dg, dt);
+        }
+}
+
+
+#ifdef SR_LEX_X86
+__attribute__((target("sse2")))
+static void _indexSse2(const char *s, size_t blocks, uint64_t *m)
+{
+        const __m128i vq = _mm_set1_epi8('"'), vc = _mm_set1_epi8(',');
+        const __m128i vnl = _mm_set1_epi8('\n'), vsp = _mm_set1_epi8(' ');
+        const __m128i vdt = _mm_set1_epi8('.');
+        const __m128i v0 = _mm_set1_epi8('0'), v9 = _mm_set1_epi8('9');
+        const __m128i vlo = _mm_set1_epi8(0x20), vhi = _mm_set1_epi8(0x7e);
+        for (size_t b = 0; b < blocks; ++b, s += 64, m += IDX_NUM) {
+                uint64_t q = 0, c = 0, nl = 0, sp = 0, pr = 0, dg = 0, dt = 0;
+                for (int i = 0; i < 4; ++i) {
+                        const __m128i x = _mm_loadu_si128((const __m128i*)(s + 16 * i));
+                        // unsigned range checks: lo <= x iff max(x, lo) == x
+                        const __m128i p = _mm_and_si128(
+                                _mm_cmpeq_epi8(_mm_max_epu8(x, vlo), x),
+                                _mm_cmpeq_epi8(_mm_min_epu8(x, vhi), x));
+                        const __m128i d = _mm_and_si128(
+                                _mm_cmpeq_epi8(_mm_max_epu8(x, v0), x),
+                                _mm_cmpeq_epi8(_mm_min_epu8(x, v9), x));
+                        const int sh = 16 * i;
+                        q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vq)) << sh;
+                        c |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vc)) << sh;
+                        nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vnl)) << sh;
+                        sp |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vsp)) << sh;
+                        dt |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, vdt)) << sh;
+                        pr |= (uint64_t)(uint16_t)_mm_movemask_epi8(p) << sh;
+                        dg |= (uint64_t)(uint16_t)_mm_movemask_epi8(d) << sh;
+                }
+                _classify(m, q, c, nl, sp, pr, dg, dt);
+        }
+}
+
+
+__attribute__((target("avx2")))
+static void _indexAvx2(const char *s, size_t blocks, uint64_t *m)
+{
+        const __m256i vq = _mm256_set1_epi8('"'), vc = _mm256_set1_epi8(',');
+        const __m256i vnl = _mm256_set1_epi8('\n'), vsp = _mm256_set1_epi8(' ');
+        const __m256i vdt = _mm256_set1_epi8('.');
+        const __m256i v0 = _mm256_set1_epi8('0'), v9 = _mm256_set1_epi8('9');
+        const __m256i vlo = _mm256_set1_epi8(0x20), vhi = _mm256_set1_epi8(0x7e);
+        for (size_t b = 0; b < blocks; ++b, s += 64, m += IDX_NUM) {
+                uint64_t q = 0, c = 0, nl = 0, sp = 0, pr = 0, dg = 0, dt = 0;
+                for (int i = 0; i < 2; ++i) {
+                        const __m256i x = _mm256_loadu_si256((const __m256i*)(s + 32 * i));
+                        const __m256i p = _mm256_and_si256(
+                                _mm256_cmpeq_epi8(_mm256_max_epu8(x, vlo), x),
+                                _mm256_cmpeq_epi8(_mm256_min_epu8(x, vhi), x));
+                        const __m256i d = _mm256_and_si256(
+                                _mm256_cmpeq_epi8(_mm256_max_epu8(x, v0), x),
+                                _mm256_cmpeq_epi8(_mm256_min_epu8(x, v9), x));
+                        const int sh = 32 * i;
+                        q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vq)) << sh;
+                        c |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vc)) << sh;
+                        nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vnl)) << sh;
+                        sp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vsp)) << sh;
+                        dt |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vdt)) << sh;
+                        pr |= (uint64_t)(uint32_t)_mm256_movemask_epi8(p) << sh;
+                        dg |= (uint64_t)(uint32_t)_mm256_movemask_epi8(d) << sh;
+                }
+                _classify(m, q, c, nl, sp, pr, dg, dt);
+        }
+}
+#endif
+
+
+static _IndexFunc _indexFunc()
+{
+#ifdef SR_LEX_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return _indexAvx2;
+        if (__builtin_cpu_supports("sse2"))
+                return _indexSse2;
+#endif
+        return _indexScalar;
+}
+
+
+void SrLexer::index()
+{
+        static const _IndexFunc func = _indexFunc();
+        const char *s = data();
+        const size_t full = n / 64, blocks = (n + 63) / 64;
+        idx.resize(blocks * IDX_NUM);
+        if (full)
+                func(s, full, &idx[0]);
+        if (full < blocks) {    // zero padded tail, NUL is garbage anyway
+                char tail[64] = {0};
+                memcpy(tail, s + full * 64, n - full * 64);
+                func(tail, 1, &idx[full * IDX_NUM]);
+        }
+}
+
+
+size_t SrLexer::find(int k, size_t pos, bool inv) const
+{
+        const uint64_t flip = inv ? ~(uint64_t)0 : 0;
+        const size_t blocks = idx.size() / IDX_NUM;
+        uint64_t mask = ~(uint64_t)0 << (pos & 63);
+        for (size_t b = pos / 64; b < blocks; ++b) {
+                const uint64_t m = (idx[b * IDX_NUM + k] ^ flip) & mask;
+                if (m)
+                        return min(n, b * 64 + __builtin_ctzll(m));
+                mask = ~(uint64_t)0;
+        }
+        return n;
+}
+
+
+size_t SrLexer::count(int k, size_t pos, size_t end) const
+{
+        size_t c = 0;
+        uint64_t mask = ~(uint64_t)0 << (pos & 63);
+        for (size_t b = pos / 64; b * 64 < end; ++b) {
+                uint64_t m = idx[b * IDX_NUM + k] & mask;
+                if ((b + 1) * 64 > end)
+                        m &= ((uint64_t)1 << (end & 63)) - 1;
+                c += __builtin_popcountll(m);
+                mask = ~(uint64_t)0;
+        }
+        return c;
+}
+
 
 SrLexer::SrToken SrLexer::next()
 {
+        const SrSpan sp = scan();
         SrLexer::SrToken tok;
-        if (end == s.size()) {
-                tok.first = SR_EOB;
+        tok.first = sp.type;
+        value(sp, tok.second);
+        return tok;
+}
+
+
+SrLexer::SrSpan SrLexer::scan()
+{
+        const char *s = data();
+        SrSpan tok = {SR_NONE, end, 0, false};
+        if (end == n) {
+                tok.type = SR_EOB;
                 pre = start = end;
                 return tok;
         }
         if (delimit) {
                 pre = end;
-                for (; end < s.size(); ++end) {
-                        if (s[end] == ',') {
-                                ++end;
-                                break;
-                        } else if (s[end] == '\n') {
-                                start = end;
-                                tok.first = SR_NEWLINE;
-                                tok.second = s[end++];
-                                delimit = false;
-                                return tok;
-                        }
+                end = find(IDX_DELIM, end);
+                if (end < n && s[end] == '\n') {
+                        start = end;
+                        tok.type = SR_NEWLINE;
+                        tok.pos = end++;
+                        tok.len = 1;
+                        delimit = false;
+                        return tok;
+                } else if (end < n) {
+                        ++end;
                 }
         }
         pre = end;
-        for (;end < s.size() && !isgraph(s[end]) && s[end] != '\n'; ++end);
-        start = end;
+        start = end = find(IDX_SKIP, end, true);
         bool escape = false;
-        size_t digits = 0, others = 0, dots = 0;
-        if (s[end] == '"') {
+        size_t pos;             // first character counted for the type
+        if (end < n && s[end] == '"') {
                 escape = true;
-                ++end;
-        } else if (s[end] == '+' || s[end] == '-') {
-                tok.second += s[end++];
-        }
-        for (; isprint(s[end]) || escape; ++end) {
-                if (isdigit(s[end])) {
-                        ++digits;
-                } else if (s[end] == '.') {
-                        ++dots;
-                } else if (s[end] == '"') {
-                        if (!escape)
+                pos = tok.pos = ++end;
+                for (;;) {
+                        end = find(IDX_QUOTE, end);
+                        if (end == n) {
                                 break;
-                        ++end;
-                        if (s[end] == '"') {
-                                ++others;
+                        } else if (end + 1 < n && s[end + 1] == '"') {
+                                tok.esc = true;
+                                end += 2;
                         } else {
                                 escape = false;
                                 break;
                         }
-                } else if (s[end] == ',' || s[end] == '\n') {
-                        if (escape) ++others;
-                        else break;
-                } else {
-                        ++others;
                 }
-                tok.second += s[end];
+                // a closed quote is not part of the value, an unclosed one
+                // runs until the end of buffer.
+                tok.len = end - tok.pos;
+                if (!escape)
+                        ++end;
+        } else {
+                tok.pos = start;
+                if (end < n && (s[end] == '+' || s[end] == '-'))
+                        ++end;
+                pos = end;
+                end = find(IDX_STOP, end);
+                tok.len = end - tok.pos;
         }
+        const size_t last = tok.pos + tok.len;
+        const size_t digits = count(IDX_DIGIT, pos, last);
+        const size_t dots = count(IDX_DOT, pos, last);
+        const size_t others = last - pos - digits - dots;
         if (escape)
-                tok.first = SR_ERROR;
+                tok.type = SR_ERROR;
         else if (others || dots > 1)
-                tok.first = SR_STRING;
+                tok.type = SR_STRING;
         else if (dots)
-                tok.first = digits ? SR_FLOAT : SR_STRING;
+                tok.type = digits ? SR_FLOAT : SR_STRING;
         else if (digits)
-                tok.first = SR_INT;
+                tok.type = SR_INT;
         else
-                tok.first = tok.second.empty() ? SR_NONE : SR_STRING;
+                tok.type = tok.len ? SR_STRING : SR_NONE;
         delimit = true;
         return tok;
 }
+
+
+void SrLexer::value(const SrSpan &tok, std::string &dest) const
+{
+        if (tok.esc) {
+                dest.clear();
+                append(tok, dest);
+        } else {
+                dest.assign(data() + tok.pos, tok.len);
+        }
+}
+
+
+void SrLexer::append(const SrSpan &tok, std::string &dest) const
+{
+        const char *s = data() + tok.pos;
+        if (!tok.esc) {
+                dest.append(s, tok.len);
+                return;
+        }
+        for (size_t i = 0; i < tok.len; ++i) {
+                dest += s[i];
+                if (s[i] == '"') ++i; // skip the second one of ""
+        }
+}
+
+
+SrRecord &SrRecord::operator=(const SrRecord &r)
+{
+        if (this == &r)
+                return *this;
+        clear();
+        for (size_t i = 0; i < r.size(); ++i)
+                append(r.type(i), r.data(i), r.length(i));
+        return *this;
+}
+
+
+void SrRecord::push_back(SrLexer::SrToken &tok)
+{
+        append(tok.first, tok.second.c_str(), tok.second.size());
+}
+
+
+bool SrRecord::equals(size_t i, const char *s) const
+{
+        const size_t len = length(i);
+        return strncmp(data(i), s, len) == 0 && s[len] == 0;
+}
+
+
+void SrRecord::append(const SrLexer &lex, const SrLexer::SrSpan &sp)
+{
+        _Field f(sp.pos, sp.len, sp.type, sp.esc);
+        if (sp.esc) {
+                f.pos = arena.size();
+                lex.append(sp, arena);
+                f.len = arena.size() - f.pos;
+        }
+        add(f);
+}
+
+
+void SrRecord::append(SrLexer::SrTokType type, const char *s, size_t len)
+{
+        _Field f(arena.size(), len, type, true);
+        arena.append(s, len);
+        add(f);
+}
+
+
+void SrRecord::add(const _Field &f)
+{
+        if (n < SR_RECORD_INLINE)
+                fix[n] = f;
+        else
+                ext.push_back(f);
+        if (n++ == 0)           // message ID, always needed for dispatching
+                toInt(fix[0]);
+        ntok = 0;
+}
+
+
+long SrRecord::toInt(const _Field &f) const
+{
+        const char *s = (f.own ? arena.data() : buf) + f.pos;
+        // an integer token is [+-]?[0-9]+, digits10 characters never overflow
+        if (f.type == SrLexer::SR_INT &&
+            f.len <= (size_t)numeric_limits<long>::digits10) {
+                size_t i = s[0] == '+' || s[0] == '-';
+                long v = 0;
+                for (; i < f.len; ++i)
+                        v = v * 10 + (s[i] - '0');
+                f.ival = s[0] == '-' ? -v : v;
+        } else {                // values are not null-terminated
+                char tmp[32];
+                if (f.len < sizeof(tmp)) {
+                        memcpy(tmp, s, f.len);
+                        tmp[f.len] = 0;
+                        f.ival = strtol(tmp, NULL, 10);
+                } else {
+                        f.ival = strtol(string(s, f.len).c_str(), NULL, 10);
+                }
+        }
+        f.cached |= _INT;
+        return f.ival;
+}
+
+
+double SrRecord::toDouble(const _Field &f) const
+{
+        const char *s = (f.own ? arena.data() : buf) + f.pos;
+        char tmp[32];
+        if (f.len < sizeof(tmp)) {
+                memcpy(tmp, s, f.len);
+                tmp[f.len] = 0;
+                f.dval = strtod(tmp, NULL);
+        } else {
+                f.dval = strtod(string(s, f.len).c_str(), NULL);
+        }
+        f.cached |= _DOUBLE;
+        return f.dval;
+}
+
+
+void SrRecord::materialize() const
+{
+        if (toks.size() < n)
+                toks.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+                toks[i].first = type(i);
+                toks[i].second.assign(data(i), length(i));
+        }
+        ntok = n;
+}
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <cstdlib>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include <curl/curl.h>
 #include <sragent.h>
 #include <srlogger.h>
@@ -19,6 +22,7 @@ static void ignoreSignal(int sig)
 
 SrAgent::SrAgent(const string &_server, const string &deviceid,
                  SrIntegrate *igt, SrBootstrap *boot):
+        epfd(epoll_create1(EPOLL_CLOEXEC)), tfd(-1), parser(NULL, 0),
         _server(_server), did(deviceid), pboot(boot), pigt(igt)
 {
         curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -26,7 +30,12 @@ SrAgent::SrAgent(const string &_server, const string &deviceid,
 }
 
 
-SrAgent::~SrAgent() {curl_global_cleanup();}
+SrAgent::~SrAgent()
+{
+        if (tfd != -1) close(tfd);
+        if (epfd != -1) close(epfd);
+        curl_global_cleanup();
+}
 
 
 int SrAgent::bootstrap(const string &path)
@@ -62,6 +71,7 @@ int SrAgent::integrate(const string &srv, const string &srt)
 
 
 int SrAgent::send(const SrNews &news) {return egress.put(news);}
+int SrAgent::send(SrNews &&news) {return egress.put(std::move(news));}
 
 
 static string _com(const uint32_t xid, const string &id)
@@ -70,35 +80,41 @@ static string _com(const uint32_t xid, const string &id)
 }
 
 
-void SrAgent::processMessages()
+static string _msg(const SrRecord &r) {return string(r.data(0), r.length(0));}
+
+
+void SrAgent::processMessages(int millisec)
 {
-        SrQueue<SrOpBatch>::Event e = ingress.get(200);
+        SrQueue<SrOpBatch>::Event e = ingress.get(millisec);
         if (e.second != SrQueue<SrOpBatch>::Q_OK) return;
         const MsgXID m = strtoul(xid.c_str(), NULL, 10);
         MsgXID c = m;
-        SmartRest sr(e.first.data);
-        for (SrRecord r = sr.next(); r.size(); r = sr.next()) {
-                MsgID j = strtoul(r[0].second.c_str(), NULL, 10);
+        // re-using the parser keeps the storage of its structural index
+        parser.reset(e.first.data.c_str(), e.first.data.size());
+        SrRecord &r = rec;
+        while (parser.next(r)) {
+                // values are terminated by a delimiter or the end of batch
+                const MsgID j = r.asMsgId();
                 if (j == 87) {
-                        c = strtoul(r[2].second.c_str(), NULL, 10);
+                        c = r.asInt(2);
                 } else if (c == m) {
-                        _Handler::iterator it = handlers.find(j);
-                        if (it != handlers.end() && it->second) {
-                                srDebug("Trigger Msg " + r[0].second);
-                                (*it->second)(r, *this);
+                        SrMsgHandler *h = handlers.find(j);
+                        if (h) {
+                                srDebug("Trigger Msg " + _msg(r));
+                                (*h)(r, *this);
 #ifdef DEBUG
                         } else {
-                                srDebug("Drop Msg " + r[0].second);
+                                srDebug("Drop Msg " + _msg(r));
 #endif
                         }
                 } else {
-                        _XHandler::iterator it = sh.find(XMsgID(c, j));
-                        if (it != sh.end() && it->second) {
-                                srDebug("Trigger Msg " + _com(c, r[0].second));
-                                (*it->second)(r, *this);
+                        SrMsgHandler *h = sh.find(c, j);
+                        if (h) {
+                                srDebug("Trigger Msg " + _com(c, _msg(r)));
+                                (*h)(r, *this);
 #ifdef DEBUG
                         } else {
-                                srDebug("Drop Msg " + _com(c, r[0].second));
+                                srDebug("Drop Msg " + _com(c, _msg(r)));
 #endif
                         }
                 }
@@ -106,19 +122,123 @@ void SrAgent::processMessages()
 }
 
 
+void SrAgent::processTimers()
+{
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        // collect the due timers first, as callbacks may start or stop any
+        // timer, including the ones due in this round.
+        due.clear();
+        while (!timers.empty() && timers.top()->fireTime() <= now)
+                due.push_back(timers.pop());
+        for (auto &i: due) {
+                if (i->isActive() && i->fireTime() <= now) {
+                        i->run(*this);
+                        if (i->isActive()) i->start();
+                }
+        }
+}
+
+
 void SrAgent::loop()
 {
-        const timespec ts = {SR_AGENT_VAL/1000, (SR_AGENT_VAL%1000) * 1000000};
         while (true) {
-                clock_nanosleep(CLOCK_MONOTONIC_COARSE, 0, &ts, NULL);
-                for (auto &i: timers) {
+                processTimers();
+                // wait for messages until the nearest deadline, polling at
+                // most every SR_AGENT_VAL and at least every 200 ms.
+                long ms = 200;
+                if (!timers.empty()) {
                         timespec now;
                         clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
-                        if (i->isActive() && i->fireTime() <= now) {
-                                i->run(*this);
-                                if (i->isActive()) i->start();
+                        const timespec &t = timers.top()->fireTime();
+                        const long d = (t.tv_sec - now.tv_sec) * 1000 +
+                                (t.tv_nsec - now.tv_nsec + 999999) / 1000000;
+                        ms = min(ms, max(d, (long)SR_AGENT_VAL));
+                }
+                processMessages(ms);
+        }
+}
+
+
+int SrAgent::addFdHandler(int fd, SrFdHandler *h, uint32_t events)
+{
+        if (epfd == -1 || fd < 0)
+                return -1;
+        const bool exist = (size_t)fd < fds.size() && fds[fd];
+        epoll_event ev;
+        ev.events = events;
+        ev.data.fd = fd;
+        if (h == NULL) {
+                if (exist) fds[fd] = NULL;
+                return exist ? epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev) : 0;
+        }
+        if (epoll_ctl(epfd, exist ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev))
+                return -1;
+        if ((size_t)fd >= fds.size())
+                fds.resize(fd + 1, NULL);
+        fds[fd] = h;
+        return 0;
+}
+
+
+int SrAgent::eventLoop()
+{
+        const int efd = ingress.enableEvent();
+        if (tfd == -1)
+                tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+        if (epfd == -1 || efd == -1 || tfd == -1)
+                return -1;
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = efd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev);
+        ev.data.fd = tfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+        // Timers use the coarse clock, arming the timerfd exactly at a fire
+        // time would wake up before the coarse clock reaches it, thus one
+        // tick of slack avoids spinning until then.
+        timespec slack = {0, 0};
+        clock_getres(CLOCK_MONOTONIC_COARSE, &slack);
+        itimerspec armed = {{0, 0}, {0, 0}};
+        epoll_event evs[16];
+        // messages put before the eventfd was enabled are not signaled
+        while (!ingress.empty())
+                processMessages(0);
+        while (true) {
+                processTimers();
+                itimerspec its = {{0, 0}, {0, 0}};
+                if (!timers.empty()) {
+                        const timespec &t = timers.top()->fireTime();
+                        its.it_value.tv_sec = t.tv_sec + slack.tv_sec;
+                        its.it_value.tv_nsec = t.tv_nsec + slack.tv_nsec;
+                        if (its.it_value.tv_nsec >= 1000000000) {
+                                ++its.it_value.tv_sec;
+                                its.it_value.tv_nsec -= 1000000000;
+                        }
+                }
+                if (its.it_value.tv_sec != armed.it_value.tv_sec ||
+                    its.it_value.tv_nsec != armed.it_value.tv_nsec) {
+                        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+                        armed = its;
+                }
+                const int n = epoll_wait(epfd, evs, 16, -1);
+                for (int i = 0; i < n; ++i) {
+                        const int fd = evs[i].data.fd;
+                        uint64_t val;
+                        if (fd == efd) {
+                                ssize_t r = read(efd, &val, sizeof(val));
+                                (void)r;
+                                while (!ingress.empty())
+                                        processMessages(0);
+                        } else if (fd == tfd) {
+                                // expired, re-arm even for the same deadline
+                                ssize_t r = read(tfd, &val, sizeof(val));
+                                (void)r;
+                                armed = itimerspec();
+                        } else if ((size_t)fd < fds.size() && fds[fd]) {
+                                (*fds[fd])(fd, evs[i].events, *this);
                         }
                 }
-                processMessages();
         }
+        return 0;
 }
@@ -76,7 +76,7 @@ void *SrDevicePush::func(void *arg)
                                 SrOpBatch b(push->http.response());
                                 push->process(b.data);
                                 if (!push->isSleeping())
-                                        push->queue.put(b);
+                                        push->queue.put(std::move(b));
                         }
                 }
         }
@@ -127,16 +127,17 @@ int SrDevicePush::connect()
 
 void SrDevicePush::process(string &s)
 {
-        SmartRest sr(s);
+        SmartRest sr(s.c_str(), s.size());
+        SrRecord r;
         size_t p1 = string::npos, p2 = string::npos, s1 = 0, s2 = 0;
-        for (SrRecord r = sr.next(); r.size(); r = sr.next()) {
-                if (r[0].second == "88") {
+        while (sr.next(r)) {
+                if (r.equals(0, "88")) {
                         p1 = sr.pre;
-                        bnum = strtoul(r[1].second.c_str(), NULL, 10);
+                        bnum = r.asInt(1);
                         s1 = sr.end - p1;
-                } else if (r[0].second == "86") {
+                } else if (r.equals(0, "86")) {
                         p2 = sr.pre;
-                        bayeuxPolicy = r[4].second == "retry" ? 3 : 1;
+                        bayeuxPolicy = r.equals(4, "retry") ? 3 : 1;
                         s2 = sr.end - p2;
                 }
         }
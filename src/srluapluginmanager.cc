@@ -41,7 +41,7 @@ SrLuaPluginManager::~SrLuaPluginManager()
 void SrLuaPluginManager::operator()(SrRecord &r, SrAgent &agent)
 {
         UNUSED(agent);
-        SrAgent::MsgID j = strtoul(r[0].second.c_str(), NULL, 10);
+        const SrAgent::MsgID j = r.asMsgId();
         _Handler::const_iterator it = handlers.find(j);
         if (it != handlers.end()) {
                 const string &cb = it->second.second;
@@ -90,6 +90,8 @@ void SrLuaPluginManager::init(lua_State *L)
                 .beginClass<SrRecord>("SrRecord")
                 .addFunction("type", &SrRecord::typeInt)
                 .addFunction("value", &SrRecord::value)
+                .addFunction("asInt", &SrRecord::asInt)
+                .addFunction("asDouble", &SrRecord::asDouble)
                 .addProperty("size", &SrRecord::size)
                 .endClass()
                 .addFunction("srDebug", srDebug)
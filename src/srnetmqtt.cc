@@ -4,6 +4,7 @@
 #include <errno.h>
 #include "srlogger.h"
 #include "srnetmqtt.h"
+#include "srtopictrie.h"
 using namespace std;
 
 #define EMQTT_BASE CURL_LAST
@@ -15,19 +16,40 @@ using namespace std;
 #define EMQTT_PACKET (EMQTT_AUTH + 1)
 #define EMQTT_SERIAL (EMQTT_PACKET + 1)
 #define EMQTT_DESERIAL (EMQTT_SERIAL + 1)
-#define EMQTT_LAST (EMQTT_DESERIAL + 1)
+#define EMQTT_NOPACKET (EMQTT_DESERIAL + 1)
+#define EMQTT_LAST (EMQTT_NOPACKET + 1)
+
+// Initial size of the receive buffer, it grows for larger packets.
+#define SR_MQTT_RXBUF_SIZE (4 * SR_SOCK_RXBUF_SIZE)
+// Maximum number of reads per yield().
+#define SR_MQTT_READS 64
+// Queued bytes which trigger a flush() in publishAsync().
+#define SR_MQTT_TXQ_SIZE (16 * SR_SOCK_RXBUF_SIZE)
 
 static const char* emsg[] = {
         "OK!", "unacceptable protocol version", "client id rejected",
         "server unavailable", "bad user name or password", "not authorized",
-        "invalid packet", "serialization error", "deserialization error"
+        "invalid packet", "serialization error", "deserialization error",
+        "no free packet identifier"
 };
 
 
 SrNetMqtt::SrNetMqtt(const string &id, const string &server):
-        SrNetSocket(server), client(id) ,pval(0), wqos(0),
-        iswill(), wretain(), isuser(), ispass()
+        SrNetSocket(server), router(new _TopicTrie), rx(SR_MQTT_RXBUF_SIZE),
+        rbeg(0), rend(0), busy(false), client(id), pval(0), pid(0), wqos(0), iswill(),
+        wretain(), isuser(), ispass()
+{
+}
+
+
+SrNetMqtt::~SrNetMqtt()
+{
+}
+
+
+void SrNetMqtt::addMsgHandler(const string &t, SrMqttAppMsgHandler *mh)
 {
+        router->add(t, mh);
 }
 
 void SrNetMqtt::setKeepalive(int val)
@@ -42,6 +64,10 @@ int SrNetMqtt::connect(bool clean, char nflag)
         (void)nflag;
         if (SrNetSocket::connect() == -1)
                 return -1;
+        rbeg = rend = 0;        // partial packet of the previous connection
+        txq.clear();            // the caller re-publishes what is in flight
+        if (clean)
+                received.clear();
 
         MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
         data.keepAliveInterval = pval;
@@ -79,35 +105,119 @@ int SrNetMqtt::connect(bool clean, char nflag)
 }
 
 
-int SrNetMqtt::publish(const string &topic, const string &msg, char nflag)
+// Append a PUBLISH packet to out.
+static void pub(string &out, const string &topic, const string &msg,
+                char nflag, uint16_t packet)
 {
         const int qos = (nflag >> 1) & 3;
-        srDebug("MQTT pub: " + topic + '@' + to_string(qos) + ": " + msg);
-        unsigned char buf[100];
+        if (srLogIsEnabledFor(SRLOG_DEBUG))
+                srDebug("MQTT pub: " + topic + '@' + to_string(qos) + ": " +
+                        msg);
+        unsigned char buf[8];
         unsigned char *ptr = buf;
         *ptr++ = 0x30 | nflag;
         const int remlen = 2 + topic.size() + (qos ? 2 : 0) + msg.size();
         ptr += MQTTPacket_encode(ptr, remlen);
-        writeCString(&ptr, topic.c_str());
-        if (qos) writeInt(&ptr, 1);
-        if (sendBuf((const char *)buf, ptr - buf) != ptr - buf)
+        writeInt(&ptr, topic.size());
+        out.append((const char*)buf, ptr - buf);
+        out += topic;
+        if (qos) {
+                out += (char)(packet >> 8);
+                out += (char)packet;
+        }
+        out += msg;
+}
+
+
+// Append an acknowledgement packet to out.
+static void ack(string &out, unsigned char type, uint16_t packet)
+{
+        unsigned char buf[4];
+        const int len = MQTTSerialize_ack(buf, sizeof(buf), type, 0, packet);
+        out.append((const char*)buf, len);
+}
+
+
+int SrNetMqtt::flush()
+{
+        if (txq.empty())
+                return 0;
+        const int c = sendAll(txq.data(), txq.size());
+        txq.clear();            // lost on a broken connection anyway
+        return c == -1 ? -1 : 0;
+}
+
+
+int SrNetMqtt::publish(const string &topic, const string &msg, char nflag)
+{
+        const int c = publishAsync(topic, msg, nflag);
+        if (c == -1 || flush() == -1) {
+                if (c > 0) complete(c);
+                srError(string("MQTT pub: ") + _errMsg);
                 return -1;
-        size_t len = msg.size();
-        const char *pch = msg.c_str();
-        for (size_t i = 0; i < len;) {
-                int n = sendBuf(pch + i, len - i);
-                if (n == -1) return -1;
-                i += n;
+        } else if (c == 0 || busy) {
+                return 0;       // in a handler, acknowledged after it
         }
+        timespec t1, t2;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &t1);
         errno = errNo = 0;
-        if (qos)
-                len = recv(SR_SOCK_RXBUF_SIZE);
-        if (len <= 0) {
-                srError(string("MQTT pub: ") + _errMsg);
+        while (isInflight(c)) {
+                clock_gettime(CLOCK_MONOTONIC_COARSE, &t2);
+                if (timeout() && t2.tv_sec - t1.tv_sec > timeout())
+                        break;
+                const int n = receive(-1);
+                if (flush() == -1)
+                        break;
+                if (n == 0 || (n == -1 && errNo != CURLE_AGAIN))
+                        break;
+        }
+        if (isInflight(c)) {
+                complete(c);    // the caller publishes anew
+                srError(string("MQTT pub: ") + (errNo ? _errMsg : "timeout"));
                 return -1;
-        } else {
-                return 0;
         }
+        return 0;
+}
+
+
+int SrNetMqtt::publishAsync(const string &topic, const string &msg,
+                            char nflag, uint16_t packet)
+{
+        const int qos = (nflag >> 1) & 3;
+        if (qos && packet == 0) {
+                if (pending.size() >= 0xffff) {
+                        errNo = EMQTT_NOPACKET;
+                        strcpy(_errMsg, emsg[errNo - EMQTT_BASE]);
+                        return -1;
+                }
+                do {
+                        pid = pid == 0xffff ? 1 : pid + 1;
+                } while (isInflight(pid));
+                packet = pid;
+        }
+        // once PUBREC is received, only the PUBREL is sent again
+        if (qos == 2 && isReleased(packet))
+                ack(txq, PUBREL, packet);
+        else
+                pub(txq, topic, msg, nflag, packet);
+        if (txq.size() >= SR_MQTT_TXQ_SIZE && flush() == -1)
+                return -1;
+        if (qos == 0)
+                return 0;
+        if (!isInflight(packet))
+                pending.push_back(packet);
+        return packet;
+}
+
+
+void SrNetMqtt::complete(uint16_t packet)
+{
+        auto it = find(pending.begin(), pending.end(), packet);
+        if (it != pending.end())
+                pending.erase(it);
+        it = find(released.begin(), released.end(), packet);
+        if (it != released.end())
+                released.erase(it);
 }
 
 
@@ -258,27 +368,162 @@ int SrNetMqtt::unsubscribe(const string topics[], int count, char nflag)
 int SrNetMqtt::disconnect(char nflag)
 {
         (void)nflag;
+        flush();
         unsigned char buf[200];
         const int len = MQTTSerialize_disconnect(buf, sizeof(buf));
         return sendBuf((const char*)buf, len) == len ? 0 : -1;
 }
 
 
-static int _schedule(unsigned char *buf, int len, int &qos, uint16_t &packet,
-                     SrMqttAppMsg &msg)
+void SrNetMqtt::rxReserve(size_t n)
 {
-        MQTTString ts = MQTTString_initializer;
-        unsigned char dup, retain, *payload;
-        int n;
-        if (MQTTDeserialize_publish(&dup, &qos, &retain, &packet,
-                                    &ts, &payload, &n, buf, len) != 1)
-                return -1;
-        else if (buf + len < payload + n)
-                return 0;
+        if (rx.size() - rend >= n)
+                return;
+        if (rbeg) {             // only the undecoded bytes are moved
+                memmove(rx.data(), rx.data() + rbeg, rend - rbeg);
+                rend -= rbeg;
+                rbeg = 0;
+        }
+        if (rx.size() - rend < n)
+                rx.resize(max(rx.size() * 2, rend + n));
+}
+
 
-        msg.topic.assign((char *)ts.lenstring.data, ts.lenstring.len);
-        msg.data.assign((char*)payload, n);
-        return payload - buf + n;
+void SrNetMqtt::dispatch(const unsigned char *p, size_t hlen, size_t len)
+{
+        const char type = (*p & 0xf0) >> 4;
+        switch (type) {
+        case 3: {
+                MQTTString ts = MQTTString_initializer;
+                unsigned char dup, retain, *payload;
+                unsigned short packet;
+                int qos, n;
+                if (MQTTDeserialize_publish(&dup, &qos, &retain, &packet, &ts,
+                                            &payload, &n, (unsigned char*)p,
+                                            len) != 1) {
+                        errNo = EMQTT_DESERIAL;
+                        strcpy(_errMsg, emsg[errNo - EMQTT_BASE]);
+                        srWarning(string("MQTT recv: ") + _errMsg);
+                        break;
+                }
+                if (qos == 1) {
+                        ack(txq, PUBACK, packet);
+                } else if (qos == 2) {
+                        ack(txq, PUBREC, packet);
+                        // deliver once, until the server sends PUBREL
+                        auto it = find(received.begin(), received.end(),
+                                       packet);
+                        if (it != received.end())
+                                break;
+                        received.push_back(packet);
+                }
+                const SrMqttAppView v(ts.lenstring.data, ts.lenstring.len,
+                                      (const char*)payload, n);
+                if (srLogIsEnabledFor(SRLOG_DEBUG)) {
+                        srDebug("MQTT appmsg: " + string(v.topic, v.tlen) +
+                                '@' + to_string(qos) + ": " +
+                                string(v.data, v.dlen));
+                }
+                router->match(v.topic, v.tlen, hits);
+                for (auto h: hits)
+                        (*h)(v);
+                break;
+        }
+        case 4:                // puback
+        case 5:                // pubrec
+        case 6:                // pubrel
+        case 7: {              // pubcomp
+                if (len - hlen < 2)
+                        break;
+                const uint16_t id = (p[hlen] << 8) | p[hlen + 1];
+                if (type == 5) {
+                        if (isInflight(id) && !isReleased(id))
+                                released.push_back(id);
+                        ack(txq, PUBREL, id);
+                } else if (type == 6) {
+                        auto it = find(received.begin(), received.end(), id);
+                        if (it != received.end())
+                                received.erase(it);
+                        ack(txq, PUBCOMP, id);
+                } else {
+                        complete(id);
+                }
+                break;
+        }
+        case 2:                // connack
+        case 9:                // suback
+        case 11:               // unsuback
+        case 13: break;        // pingresp
+        default: srWarning("MQTT recv: type " + to_string((int)type));
+        }
+}
+
+
+// Dispatch all complete packets in [rbeg, rend), a trailing partial packet
+// is kept for the next read.
+void SrNetMqtt::decode()
+{
+        while (rend - rbeg >= 2) {
+                const unsigned char *p = (unsigned char*)rx.data() + rbeg;
+                const size_t avail = rend - rbeg;
+                size_t remlen = 0, mul = 1, i = 1;
+                for (; i < avail && i <= 4; ++i, mul *= 128) {
+                        remlen += (p[i] & 127) * mul;
+                        if ((p[i] & 128) == 0)
+                                break;
+                }
+                if (i > 4) {    // no way to resynchronize, drop everything
+                        errNo = EMQTT_PACKET;
+                        strcpy(_errMsg, emsg[errNo - EMQTT_BASE]);
+                        srWarning(string("MQTT recv: ") + _errMsg);
+                        rbeg = rend;
+                        break;
+                } else if (i == avail || avail < i + 1 + remlen) {
+                        break;
+                }
+                // consumed before the handlers run, which may call back
+                rbeg += i + 1 + remlen;
+                busy = true;
+                dispatch(p, i + 1, i + 1 + remlen);
+                busy = false;
+        }
+        if (rbeg == rend) {
+                rbeg = rend = 0;
+                if (rx.size() > SR_MQTT_RXBUF_SIZE) {
+                        rx.resize(SR_MQTT_RXBUF_SIZE);
+                        rx.shrink_to_fit();
+                }
+        }
+}
+
+
+// Read once into the receive buffer, waiting as recvBuf() for ms, after
+// taking over what the other methods left in resp, and dispatch the
+// complete packets. Called from a handler, the receive buffer is in use,
+// the data is only appended to resp and dispatched after the handler.
+int SrNetMqtt::receive(int ms)
+{
+        if (busy) {
+                char buf[SR_SOCK_RXBUF_SIZE];
+                const int n = recvBuf(buf, sizeof(buf), ms);
+                if (n > 0)
+                        resp.append(buf, n);
+                return n;
+        }
+        if (!resp.empty()) {
+                rxReserve(resp.size());
+                memcpy(rx.data() + rend, resp.data(), resp.size());
+                rend += resp.size();
+                resp.clear();
+                decode();
+        }
+        rxReserve(SR_SOCK_RXBUF_SIZE);
+        const int n = recvBuf(rx.data() + rend, rx.size() - rend, ms);
+        if (n > 0) {
+                rend += n;
+                decode();
+        }
+        return n;
 }
 
 
@@ -289,65 +534,15 @@ int SrNetMqtt::yield(int ms)
         if (pval && t0.tv_sec + pval <= now.tv_sec) {
                 if (ping() == -1) return -1;
                 t0.tv_sec = now.tv_sec;
-        } else {
-                int mysec = this->t;
-                this->t = ms < 1000 ? 1 : ms / 1000;
-                recv(SR_SOCK_RXBUF_SIZE);
-                this->t = mysec;
-                if (resp.empty()) return 0;
+                ms = 0;
         }
-
-        auto lm = [](const _Item &l, const string &r) {return l.first < r;};
-
-        int i = 0;
-        const int len = resp.size();
-        SrMqttAppMsg msg;
-        for (int n = 0; i < len; i += n) {
-                unsigned char *buf = (unsigned char*)resp.c_str() + i;
-                const char type = ((*buf) & 0xf0) >> 4;
-                switch (type) {
-                case 3: {
-                        int qos;
-                        unsigned short packet;
-                        n = _schedule(buf, len - i, qos, packet, msg);
-                        if (n == -1) {
-                                errNo = EMQTT_DESERIAL;
-                                strcpy(_errMsg, emsg[errNo - EMQTT_BASE]);
-                                srWarning(string("MQTT recv: ") + _errMsg);
-                                break;
-                        } else if (n == 0) {
-                                goto EXIT;
-                        }
-                        if (qos == 1) {
-                                unsigned char pb[10];
-                                int pl = MQTTSerialize_puback(pb, 10, packet);
-                                sendBuf((char*)pb, pl);
-                        }
-                        srDebug("MQTT appmsg: " + msg.topic + '@' +
-                                to_string(qos) + ": " + msg.data);
-                        auto beg = hdls.begin();
-                        auto end = hdls.end();
-                        auto it = lower_bound(beg, end, msg.topic, lm);
-                        if (it != hdls.end() && it->first == msg.topic)
-                                (*it->second)(msg);
+        if (flush() == -1)
+                return -1;
+        for (int k = 0; k < SR_MQTT_READS; ++k) {
+                if (receive(k == 0 ? max(ms, 0) : 0) <= 0)
                         break;
-                }
-                case 2:                // connack
-                case 4:                // puback
-                case 5:                // pubrec
-                case 6:                // pubrel
-                case 7:                // pubcomp
-                case 11: n = 4; break; // unsuback
-                case 9: ++i;         // suback
-                        i += MQTTPacket_decodeBuf(buf + 1, &n); break;
-                case 13: n = 2; break; // pingresp
-                default: srWarning("MQTT recv: type " + to_string((int)type));
-                        n = 1;
-                }
         }
-EXIT:
-        resp.erase(0, i);
-        return 0;
+        return flush();         // the acknowledgements of what was received
 }
 
 
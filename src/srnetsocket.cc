@@ -1,4 +1,7 @@
 #include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include <srnetsocket.h>
 #include <srlogger.h>
 using namespace std;
@@ -17,23 +20,16 @@ static int getSocket(CURL* curl, curl_socket_t &sockfd)
 }
 
 
-static int waitSocket(curl_socket_t sockfd, bool for_recv, int timeout)
+static long long msNow()
 {
-        struct timeval tv = {timeout, 0};
-        struct timeval *ptv = timeout ? &tv : NULL;
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(sockfd, &fds);
-        fd_set *rdfds = for_recv ? &fds : NULL;
-        fd_set *wrfds = for_recv ? NULL : &fds;
-        // Do not test for select() == 0, some devices has quirky libcurl or
-        // driver, select() returns 0 even there is data to read, rely on
-        // curl_easy_send() and curl_easy_recv() with CURLE_AGAIN for testing.
-        return select(sockfd + 1, rdfds, wrfds, NULL, ptv);
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 
-SrNetSocket::SrNetSocket(const string &s): SrNetInterface(s), _server(s)
+SrNetSocket::SrNetSocket(const string &s): SrNetInterface(s), _server(s),
+                                           fd(-1), epfd(-1)
 {
         // dead connections consume significant mem when using SSL
         curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, 1);
@@ -41,6 +37,13 @@ SrNetSocket::SrNetSocket(const string &s): SrNetInterface(s), _server(s)
 }
 
 
+SrNetSocket::~SrNetSocket()
+{
+        if (epfd != -1)
+                close(epfd);
+}
+
+
 int SrNetSocket::connect()
 {
         curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1);
@@ -52,27 +55,58 @@ int SrNetSocket::connect()
                 srError(string("Sock connect: ") + _errMsg);
                 return -1;
         }
-        srDebug("Sock connect: OK!");
-        return errNo;
-}
-
-
-int SrNetSocket::sendBuf(const char *buf, size_t len)
-{
         curl_socket_t sockfd;
         errNo = getSocket(curl, sockfd);
         if (errNo != CURLE_OK) {
-                srError(string("Sock send: ") + _errMsg);
+                srError(string("Sock connect: ") + _errMsg);
                 return -1;
         }
-        int c = waitSocket(sockfd, 0, timeout());
-        if (c < 0) {
-                srError(string("Sock send: ") + strerror(errno));
+        if (epfd == -1)
+                epfd = epoll_create1(EPOLL_CLOEXEC);
+        else if (fd != -1 && fd != sockfd)      // in case it is still open
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        fd = sockfd;
+        // registered once per connection, edge-triggered, as the socket is
+        // only waited for after an operation would block
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.fd = fd;
+        int c = epfd == -1 ? -1 : epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        if (c == -1 && errno == EEXIST)
+                c = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+        if (c == -1) {
+                srError(string("Sock connect: ") + strerror(errno));
                 return -1;
         }
-        errNo = CURLE_OK;
+        srDebug("Sock connect: OK!");
+        return errNo;
+}
+
+
+// Wait up to ms milliseconds, -1 for ever, for the socket to change its
+// readiness. Send and receive retry on any change, so both directions are
+// watched. Do not rely on the result for timeouts, some devices have quirky
+// libcurl or drivers, rely on CURLE_AGAIN from curl_easy_send() and
+// curl_easy_recv() instead.
+int SrNetSocket::waitReady(int ms)
+{
+        epoll_event ev;
+        const int c = epoll_wait(epfd, &ev, 1, ms);
+        return c == -1 && errno == EINTR ? 0 : c;
+}
+
+
+int SrNetSocket::sendBuf(const char *buf, size_t len)
+{
         size_t n = 0;
         errNo = curl_easy_send(curl, buf, len, &n);
+        if (errNo == CURLE_AGAIN) {
+                if (waitReady(timeout() ? timeout() * 1000 : -1) < 0) {
+                        srError(string("Sock send: ") + strerror(errno));
+                        return -1;
+                }
+                errNo = curl_easy_send(curl, buf, len, &n);
+        }
         if (errNo == CURLE_OK || errNo == CURLE_AGAIN) {
                 return n;
         } else {
@@ -82,6 +116,33 @@ int SrNetSocket::sendBuf(const char *buf, size_t len)
 }
 
 
+int SrNetSocket::sendAll(const char *buf, size_t len)
+{
+        const long long t1 = msNow() + timeout() * 1000LL;
+        for (size_t i = 0; i < len;) {
+                size_t n = 0;
+                errNo = curl_easy_send(curl, buf + i, len - i, &n);
+                i += n;
+                if (errNo == CURLE_OK)
+                        continue;
+                const long long left = t1 - msNow();
+                if (errNo != CURLE_AGAIN) {
+                        srError(string("Sock send: ") + _errMsg);
+                        return -1;
+                } else if (timeout() && left <= 0) {
+                        errNo = CURLE_OPERATION_TIMEDOUT;
+                        strcpy(_errMsg, "send timeout");
+                        srError(string("Sock send: ") + _errMsg);
+                        return -1;
+                } else if (waitReady(timeout() ? left : -1) < 0) {
+                        srError(string("Sock send: ") + strerror(errno));
+                        return -1;
+                }
+        }
+        return len;
+}
+
+
 int SrNetSocket::send(const string &request)
 {
         return sendBuf(request.c_str(), request.size());
@@ -90,25 +151,35 @@ int SrNetSocket::send(const string &request)
 
 int SrNetSocket::recv(size_t len)
 {
-        curl_socket_t sockfd;
-        errNo = getSocket(curl, sockfd);
-        if (errNo != CURLE_OK) {
-                srError(string("Sock recv: ") + _errMsg);
-                return -1;
-        }
-        const int c = waitSocket(sockfd, 1, timeout());
-        if (c < 0) {
-                srError(string("Sock recv: ") + strerror(errno));
-                return -1;
-        }
         char buf[SR_SOCK_RXBUF_SIZE];
-        size_t n = 0;
-        errNo = curl_easy_recv(curl, buf, len, &n);
-        if (errNo == CURLE_OK) {
+        const int n = recvBuf(buf, len, -1);
+        if (n > 0)
                 resp.append(buf, n);
-                return n;
-        } else if (errNo != CURLE_AGAIN) {
-                srError(string("Sock recv: ") + _errMsg);
+        return n;
+}
+
+
+int SrNetSocket::recvBuf(char *buf, size_t len, int ms)
+{
+        const bool forever = ms < 0 && timeout() == 0;
+        if (ms < 0)
+                ms = timeout() * 1000;
+        const long long t1 = msNow() + ms;
+        while (true) {
+                size_t n = 0;
+                errNo = curl_easy_recv(curl, buf, len, &n);
+                if (errNo == CURLE_OK) {
+                        return n;
+                } else if (errNo != CURLE_AGAIN) {
+                        srError(string("Sock recv: ") + _errMsg);
+                        return -1;
+                }
+                const long long left = t1 - msNow();
+                if (!forever && left <= 0)
+                        return -1;
+                if (waitReady(forever ? -1 : left) < 0) {
+                        srError(string("Sock recv: ") + strerror(errno));
+                        return -1;
+                }
         }
-        return -1;
 }
@@ -0,0 +1,782 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "srpager.h"
+#include "srlogger.h"
+#if SR_BUF_COMPRESS
+#include <zlib.h>
+#endif
+using namespace std;
+
+#define SR_FILEBUF_PAGE_BASE 9
+#define SR_FILEBUF_PAGE_SIZE (1<<(SR_FILEBUF_PAGE_BASE+SR_FILEBUF_PAGE_SCALE))
+#define BASE_PAGE(x) (x & 0x07)
+#define BASE_VER(x) ((x >> 3) & 0x0f)
+#define _BASE (BASE_PAGE(SR_FILEBUF_PAGE_SCALE) | (SR_FILEBUF_VER<<3))
+#define J_HEAD 1                // journal header, index is the generation
+#define J_ADD 2                 // page appended
+#define J_GROW 3                // last page grown to offset
+#define J_POP 4                 // front batch discarded
+#define FRAME_HEAD 13           // NUL, dictionary ID, raw and compressed size
+
+
+// On-disk layout of version 1 buffers, only read for migration.
+struct _BFHead1 {
+        uint8_t base, flag;
+        uint16_t size, cnt, gen;
+};
+
+
+struct _BFPage1 {
+        uint16_t index, offset;
+        uint8_t flag, cnt;
+        uint16_t pad;
+};
+
+
+struct _BFRec1 {
+        uint8_t op, flag;
+        uint16_t index, offset, gen;
+};
+
+
+#if SR_BUF_COMPRESS
+struct _Zip::_Streams {
+        _Streams(): ok(false) {
+                memset(&d, 0, sizeof(d));
+                memset(&i, 0, sizeof(i));
+        }
+        ~_Streams() {
+                if (ok) {
+                        deflateEnd(&d);
+                        inflateEnd(&i);
+                }
+        }
+        z_stream d, i;
+        bool ok;
+};
+
+
+_Zip::_Zip(): dictid(0) {}
+_Zip::~_Zip() {}
+
+
+int _Zip::setDict(const string &_dict)
+{
+        unique_ptr<_Streams> z(new _Streams);
+        if (deflateInit2(&z->d, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK)
+                return -1;
+        if (inflateInit2(&z->i, -15) != Z_OK) {
+                deflateEnd(&z->d);
+                return -1;
+        }
+        z->ok = true;
+        zs = move(z);
+        dict = _dict;
+        dictid = adler32(adler32(0, NULL, 0), (const Bytef*)dict.data(),
+                         dict.size());
+        return 0;
+}
+
+
+int _Zip::deflate(const char *s, size_t n, string &out)
+{
+        z_stream &z = zs->d;
+        if (deflateReset(&z) != Z_OK || (!dict.empty() &&
+            deflateSetDictionary(&z, (const Bytef*)dict.data(),
+                                 dict.size()) != Z_OK))
+                return -1;
+        const size_t beg = out.size();
+        out.resize(beg + deflateBound(&z, n));
+        z.next_in = (Bytef*)s;
+        z.avail_in = n;
+        z.next_out = (Bytef*)&out[beg];
+        z.avail_out = out.size() - beg;
+        const int c = ::deflate(&z, Z_FINISH);
+        out.resize(c == Z_STREAM_END ? out.size() - z.avail_out : beg);
+        return c == Z_STREAM_END ? 0 : -1;
+}
+
+
+int _Zip::inflate(const char *s, size_t n, size_t raw, string &out)
+{
+        z_stream &z = zs->i;
+        if (inflateReset(&z) != Z_OK || (!dict.empty() &&
+            inflateSetDictionary(&z, (const Bytef*)dict.data(),
+                                 dict.size()) != Z_OK))
+                return -1;
+        const size_t beg = out.size();
+        out.resize(beg + raw);
+        z.next_in = (Bytef*)s;
+        z.avail_in = n;
+        z.next_out = (Bytef*)&out[beg];
+        z.avail_out = raw;
+        const int c = ::inflate(&z, Z_FINISH);
+        if (c != Z_STREAM_END || z.avail_out) {
+                out.resize(beg);
+                return -1;
+        }
+        return 0;
+}
+#else
+struct _Zip::_Streams {};
+_Zip::_Zip(): dictid(0) {}
+_Zip::~_Zip() {}
+int _Zip::setDict(const string &) {return -1;}
+int _Zip::deflate(const char *, size_t, string &) {return -1;}
+int _Zip::inflate(const char *, size_t, size_t, string &) {return -1;}
+#endif
+
+
+int _Pager::setCompression(const string &dict)
+{
+        unique_ptr<_Zip> z(new _Zip);
+        if (z->setDict(dict) == -1)
+                return -1;
+        zip = move(z);
+        return 0;
+}
+
+
+_MMap::~_MMap()
+{
+        if (p) munmap(p, len);
+        if (fd != -1) close(fd);
+}
+
+
+int _MMap::open(const string &fn)
+{
+        fd = ::open(fn.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+                srError("filebuf: open " + fn + ", " + strerror(errno));
+        return fd;
+}
+
+
+size_t _MMap::fileSize() const
+{
+        struct stat st;
+        return fd != -1 && fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+
+// Allocate the blocks of [off, off + n) in the file, so that storing to a
+// shared mapping of it never faults for lack of disk space.
+static int allocate(int fd, size_t off, size_t n)
+{
+        int c = posix_fallocate(fd, off, n);
+        if (c != EINVAL && c != EOPNOTSUPP && c != ENOSYS)
+                return c;
+        static const char zero[4096] = {0};
+        for (size_t i = 0; i < n; i += c) {     // not supported, write zeros
+                c = pwrite(fd, zero, min(n - i, sizeof(zero)), off + i);
+                if (c == -1 && errno != EINTR)
+                        return errno;
+                c = max(c, 0);
+        }
+        return 0;
+}
+
+
+int _MMap::resize(size_t n)
+{
+        if (n == len)
+                return 0;
+        if (fd == -1)
+                return -1;
+        // the old mapping stays valid if the file cannot grow
+        if (n > len) {
+                const size_t old = fileSize();
+                const int c = allocate(fd, len, n - len);
+                if (c) {
+                        srError(string("filebuf: allocate ") + strerror(c));
+                        if (ftruncate(fd, old) == -1)
+                                srError(string("filebuf: truncate ") +
+                                        strerror(errno));
+                        return -1;
+                }
+        }
+        if (p) munmap(p, len);
+        p = NULL;
+        len = 0;
+        if (ftruncate(fd, n) == -1)
+                return -1;
+        if (n == 0)
+                return 0;
+        void *q = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (q == MAP_FAILED) {
+                srError(string("filebuf: mmap ") + strerror(errno));
+                return -1;
+        }
+        p = (char*)q;
+        len = n;
+        return 0;
+}
+
+
+void _MMap::sync(size_t off, size_t n, bool wait)
+{
+        static const size_t mask = sysconf(_SC_PAGESIZE) - 1;
+        if (!p || off >= len)
+                return;
+        n = min(n, len - off);
+        const size_t beg = off & ~mask;
+        msync(p + beg, off + n - beg, wait ? MS_SYNC : MS_ASYNC);
+}
+
+
+_BFPager::_BFPager(const string &_fn, uint32_t c, unsigned seg):
+        _Pager(c), fn(_fn), hint(0), jpos(0), wbytes(0), fresh(false),
+        split(false)
+{
+        index.open(fn + SR_FILEBUF_INDEX_SUFFIX);
+        journal.open(fn + SR_FILEBUF_JOURNAL_SUFFIX);
+        const int ver = loadIndex();
+        if (ver == -1)
+                head.seg = seg;
+        else
+                replay(ver);
+        if (ver == 1)
+                srInfo("filebuf: migrate " + fn + " to version 2");
+        size_t maxp = 0;
+        uint8_t flag = 2;
+        for (const auto &e: pcb) {
+                maxp = max(maxp, (size_t)e.index + 1);
+                head.cnt += flag == e.flag ? 0 : 1;
+                flag = e.flag;
+        }
+        head.size = pcb.size();
+        if (reserve(maxp) == 0) {
+                // remove segments left over by a larger capacity
+                for (size_t k = segs.size(); unlink(segName(k).c_str()) == 0;)
+                        ++k;
+        } else if (maxp > mapped()) {
+                srError("filebuf: " + fn + " cannot be mapped, discarded");
+                pcb.clear();
+                head.size = head.cnt = 0;
+        }
+        for (const auto &e: pcb)
+                mark(e.index, true);
+        compact();
+}
+
+
+_BFPager::~_BFPager()
+{
+        compact();
+        for (const auto &e: segs)
+                e->sync(0, e->size(), true);
+}
+
+
+size_t _BFPager::pageSize() {return SR_FILEBUF_PAGE_SIZE;}
+
+
+// Number of pages of the front batch.
+static size_t frontBatch(const deque<_BFPage> &pcb)
+{
+        size_t i = 0;
+        while (i < pcb.size() && pcb[i].flag == pcb.front().flag)
+                ++i;
+        return i;
+}
+
+
+// Load the snapshot from the index file, returns its version, or -1 if
+// there is no valid snapshot.
+int _BFPager::loadIndex()
+{
+        head = _BFHead();
+        head.base = _BASE;
+        const size_t n = index.fileSize();
+        if (n < sizeof(_BFHead1) || index.resize(n) == -1)
+                return -1;
+        const char *ptr = index.data();
+        const uint8_t base = ptr[0];
+        if (BASE_PAGE(base) != SR_FILEBUF_PAGE_SCALE)
+                return -1;
+        if (BASE_VER(base) == 1) {
+                _BFHead1 h;
+                memcpy(&h, ptr, sizeof(h));
+                head.seg = 16;
+                head.gen = h.gen;
+                const size_t sz = min((size_t)h.size,
+                                      (n - sizeof(h)) / sizeof(_BFPage1));
+                ptr += sizeof(h);
+                _BFPage1 e;
+                for (size_t i = 0; i < sz; ++i, ptr += sizeof(e)) {
+                        memcpy(&e, ptr, sizeof(e));
+                        pcb.emplace_back(e.index, e.offset, e.flag);
+                }
+                return 1;
+        }
+        _BFHead h;
+        if (BASE_VER(base) != SR_FILEBUF_VER || n < sizeof(h))
+                return -1;
+        memcpy(&h, ptr, sizeof(h));
+        if (h.seg > 24)
+                return -1;
+        head.seg = h.seg;
+        head.gen = h.gen;
+        const size_t sz = min((size_t)h.size, (n - sizeof(h)) / sizeof(_BFPage));
+        ptr += sizeof(h);
+        _BFPage page;
+        for (size_t i = 0; i < sz; ++i, ptr += sizeof(page)) {
+                memcpy(&page, ptr, sizeof(page));
+                pcb.push_back(page);
+        }
+        return SR_FILEBUF_VER;
+}
+
+
+// Apply the journal of the same generation as the snapshot, up to the first
+// record of a different generation, i.e., left over by an older journal.
+void _BFPager::replay(int ver)
+{
+        const size_t rs = ver == 1 ? sizeof(_BFRec1) : sizeof(_BFRec);
+        const size_t n = journal.fileSize();
+        if (n < rs || journal.resize(n) == -1)
+                return;
+        const char *ptr = journal.data();
+        auto get = [ver, ptr](size_t i) {
+                _BFRec r;
+                if (ver == 1) {
+                        _BFRec1 o;
+                        memcpy(&o, ptr + i, sizeof(o));
+                        const _BFPage p(o.index, o.offset, o.flag);
+                        r = _BFRec(o.op, o.gen, p);
+                } else {
+                        memcpy(&r, ptr + i, sizeof(r));
+                }
+                return r;
+        };
+        _BFRec r = get(0);
+        if (r.op != J_HEAD || r.generation() != head.gen)
+                return;
+        for (size_t i = rs; i + rs <= n; i += rs) {
+                r = get(i);
+                if (r.generation() != head.gen)
+                        break;
+                if (r.op == J_ADD) {
+                        pcb.emplace_back(r.index, r.offset, r.flag);
+                } else if (r.op == J_GROW && !pcb.empty()) {
+                        pcb.back().offset = r.offset;
+                } else if (r.op == J_POP) {
+                        pcb.erase(pcb.begin(), pcb.begin() + frontBatch(pcb));
+                } else {
+                        break;
+                }
+        }
+}
+
+
+void _BFPager::log(const _BFRec &rec)
+{
+        if (jpos + sizeof(rec) > journal.size()) {
+                compact();
+                return;
+        }
+        memcpy(journal.data() + jpos, &rec, sizeof(rec));
+        journal.sync(jpos, sizeof(rec), false);
+        jpos += sizeof(rec);
+        wbytes += sizeof(rec);
+}
+
+
+// Write a new snapshot and start a new, empty journal. The snapshot is
+// synced before the journal header, so a crash in between leaves a stale
+// journal of an older generation, which is ignored on start-up.
+void _BFPager::compact()
+{
+        ++head.gen;
+        const size_t need = sizeof(head) + pcb.size() * sizeof(_BFPage);
+        if (index.resize(need) == -1)
+                return;
+        char *ptr = index.data();
+        memcpy(ptr, &head, sizeof(head));
+        ptr += sizeof(head);
+        for (const auto &e: pcb) {
+                memcpy(ptr, &e, sizeof(e));
+                ptr += sizeof(e);
+        }
+        index.sync(0, need, true);
+        wbytes += need;
+        const size_t n = (4 * max((size_t)cap, (size_t)64) + 1) * sizeof(_BFRec);
+        if (journal.resize(n) == -1)
+                return;
+        const _BFRec rec(J_HEAD, head.gen);
+        memcpy(journal.data(), &rec, sizeof(rec));
+        journal.sync(0, sizeof(rec), true);
+        jpos = sizeof(rec);
+        wbytes += sizeof(rec);
+}
+
+
+string _BFPager::segName(size_t k) const
+{
+        return k ? fn + "." + to_string(k) : fn;
+}
+
+
+char *_BFPager::page(uint32_t i) const
+{
+        const size_t mask = ((size_t)1 << head.seg) - 1;
+        return segs[i >> head.seg]->data() + (i & mask) * SR_FILEBUF_PAGE_SIZE;
+}
+
+
+void _BFPager::syncPage(uint32_t i, size_t off, size_t n)
+{
+        const size_t mask = ((size_t)1 << head.seg) - 1;
+        off += (i & mask) * SR_FILEBUF_PAGE_SIZE;
+        segs[i >> head.seg]->sync(off, n, false);
+}
+
+
+// Make room for at least n pages in both the bitmap and the segments. The
+// last segment grows by doubling up to the capacity, so that filling it page
+// by page remaps it only a few times.
+int _BFPager::reserve(size_t n)
+{
+        if (bits.size() * 64 < n)
+                bits.resize((n + 63) / 64, 0);
+        const size_t segp = (size_t)1 << head.seg;
+        const size_t lim = max(n, (size_t)cap);
+        for (size_t k = 0; k * segp < n; ++k) {
+                if (k == segs.size()) {
+                        segs.emplace_back(new _MMap);
+                        if (segs.back()->open(segName(k)) == -1) {
+                                segs.pop_back();
+                                return -1;
+                        }
+                }
+                const size_t m = segs[k]->size() / SR_FILEBUF_PAGE_SIZE;
+                const size_t need = min(n - k * segp, segp);
+                if (m >= need)
+                        continue;
+                const size_t sz = min(min(max(need, 2 * m), segp),
+                                      lim - k * segp);
+                if (segs[k]->resize(sz * SR_FILEBUF_PAGE_SIZE) == -1)
+                        return -1;
+        }
+        return 0;
+}
+
+
+// Number of pages backed by the segments, counted from page 0.
+size_t _BFPager::mapped() const
+{
+        const size_t segp = (size_t)1 << head.seg;
+        size_t n = 0;
+        for (const auto &e: segs) {
+                const size_t m = e->size() / SR_FILEBUF_PAGE_SIZE;
+                n += m;
+                if (m < segp)
+                        break;
+        }
+        return n;
+}
+
+
+// Release all pages from n on, segments no longer needed are removed.
+void _BFPager::trim(size_t n)
+{
+        const size_t segp = (size_t)1 << head.seg;
+        const size_t m = max((n + segp - 1) / segp, (size_t)1);
+        while (segs.size() > m) {
+                segs.pop_back();
+                unlink(segName(segs.size()).c_str());
+        }
+        const size_t sz = (n - (m - 1) * segp) * SR_FILEBUF_PAGE_SIZE;
+        if (segs.size() == m && segs.back()->size() > sz)
+                segs.back()->resize(sz);
+        bits.resize((n + 63) / 64);
+}
+
+
+void _BFPager::mark(size_t i, bool used)
+{
+        if (used) {
+                bits[i / 64] |= (uint64_t)1 << (i % 64);
+        } else {
+                bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+                hint = min(hint, i / 64);
+        }
+}
+
+
+uint32_t _BFPager::get_free_page()
+{
+        for (; hint < bits.size(); ++hint) {
+                const uint64_t w = ~bits[hint];
+                if (w) {
+                        const size_t i = hint * 64 + __builtin_ctzll(w);
+                        if (i < cap)
+                                return i;
+                        break;
+                }
+        }
+        // all pages in use, discard the oldest batch
+        const uint32_t i = pcb.front().index;
+        pop_front();
+        return i;
+}
+
+
+const string &_BFPager::front() const
+{
+        if (fresh)
+                return buf;
+        fresh = true;
+        buf.clear();
+        if (pcb.empty())
+                return buf;
+        const auto flag = pcb.front().flag;
+        for (size_t i = 0; i < pcb.size() && flag == pcb[i].flag; ++i)
+                buf.append(page(pcb[i].index), pcb[i].offset + 1);
+        if (buf.find('\0') != string::npos)
+                buf = expand(buf);
+        return buf;
+}
+
+
+// Inflate the compressed frames in s.
+string _BFPager::expand(const string &s) const
+{
+        string out;
+        for (size_t i = 0; i < s.size();) {
+                const size_t j = min(s.find('\0', i), s.size());
+                out.append(s, i, j - i);
+                if (j + FRAME_HEAD > s.size())
+                        break;
+                uint32_t h[3];          // dictionary ID, raw, compressed
+                memcpy(h, s.data() + j + 1, sizeof(h));
+                i = j + FRAME_HEAD + h[2];
+                if (i > s.size()) {
+                        srError("filebuf: truncated frame");
+                        break;
+                } else if (!zip || zip->id() != h[0] ||
+                           zip->inflate(s.data() + j + FRAME_HEAD, h[2],
+                                        h[1], out) == -1) {
+                        srError("filebuf: drop frame of dict " +
+                                to_string(h[0]));
+                }
+        }
+        return out;
+}
+
+
+void _BFPager::pop_front()
+{
+        const size_t n = frontBatch(pcb);
+        for (size_t i = 0; i < n; ++i)
+                mark(pcb[i].index, false);
+        pcb.erase(pcb.begin(), pcb.begin() + n);
+        head.size = pcb.size();
+        --head.cnt;
+        ++npop;
+        fresh = false;
+        log(_BFRec(J_POP, head.gen));
+}
+
+
+int _BFPager::emplace_back(const char *s, size_t n)
+{
+        if (zip && n > FRAME_HEAD) {
+                tmp.assign(FRAME_HEAD, '\0');
+                if (zip->deflate(s, n, tmp) == 0 && tmp.size() < n) {
+                        const uint32_t h[3] = {zip->id(), (uint32_t)n,
+                                (uint32_t)(tmp.size() - FRAME_HEAD)};
+                        memcpy(&tmp[1], h, sizeof(h));
+                        return append(tmp.data(), tmp.size());
+                }
+        }
+        return append(s, n);
+}
+
+
+int _BFPager::append(const char *s, size_t n)
+{
+        if (head.cnt <= 1)      // the front batch is also the last one
+                fresh = false;
+        const auto sz = SR_FILEBUF_PAGE_SIZE;
+        if (pcb.empty() || split || n + pcb.back().offset + 1 > sz) {
+                split = false;
+                return push_back(s, n);
+        }
+        auto &t = pcb.back();
+        memcpy(page(t.index) + t.offset + 1, s, n);
+        syncPage(t.index, t.offset + 1, n);
+        t.offset += n;
+        log(_BFRec(J_GROW, head.gen, t));
+        return 0;
+}
+
+
+void _BFPager::clear()
+{
+        if (pcb.empty() && mapped() <= cap)
+                return;         // nothing to drop, spare the index writes
+        npop += head.cnt;
+        pcb.clear();
+        fill(bits.begin(), bits.end(), 0);
+        hint = 0;
+        head.size = head.cnt = 0;
+        fresh = false;
+        compact();
+        const size_t c = cap;
+        const size_t n = mapped();
+        if (c < n) {
+                trim(c);
+                srInfo("filebuf: truncate " + to_string(c));
+        }
+}
+
+
+int _BFPager::push_back(const char *buf, size_t n)
+{
+        const auto sz = SR_FILEBUF_PAGE_SIZE;
+        // the lowest free pages are taken, so all of them lie below the
+        // pages in use plus the new ones.
+        const size_t need = min(pcb.size() + (n + sz - 1) / sz, (size_t)cap);
+        if (cap == 0 || reserve(need) == -1)
+                return -1;
+        const uint8_t flag = (pcb.empty() || pcb.back().flag) ? 0 : 1;
+        for (size_t i = 0; i < n; i += sz) {
+                const size_t c = min(n - i, (size_t)sz);
+                const auto index = get_free_page();
+                memcpy(page(index), buf + i, c);
+                syncPage(index, 0, c);
+                mark(index, true);
+                pcb.emplace_back(index, c - 1, flag);
+                log(_BFRec(J_ADD, head.gen, pcb.back()));
+        }
+        head.size = pcb.size();
+        ++head.cnt;
+        return 0;
+}
+
+
+// Offset of n contiguous free bytes in the ring, the oldest batches are
+// discarded to make room, -1 if n exceeds the ring.
+long _MemPager::alloc(size_t n)
+{
+        if (n > ring.size())
+                return -1;
+        for (; !recs.empty(); drop()) {
+                const size_t beg = recs.front().off;
+                const size_t end = recs.back().off + recs.back().len;
+                if (recs.back().off < beg) {    // wrapped around
+                        if (n <= beg - end)
+                                return end;
+                } else if (n <= ring.size() - end) {
+                        return end;
+                } else if (n <= beg) {
+                        return 0;
+                }
+        }
+        return 0;
+}
+
+
+void _MemPager::drop()
+{
+        used -= recs.front().len;
+        recs.pop_front();
+        ++npop;
+        fresh = false;
+}
+
+
+void _MemPager::seal()
+{
+        const size_t budget = (size_t)cap * SR_MEMBUF_UNIT;
+        if (recs.empty() && ring.size() != budget) {
+                ring.resize(budget);
+                ring.shrink_to_fit();
+        }
+        _Rec r = {0, open.size(), 0};
+        const char *p = open.data();
+        tmp.clear();
+        if (zip && zip->deflate(open.data(), open.size(), tmp) == 0 &&
+            tmp.size() < open.size()) {
+                r.raw = open.size();
+                r.len = tmp.size();
+                p = tmp.data();
+        }
+        const long off = alloc(r.len);
+        if (off != -1) {
+                r.off = off;
+                memcpy(ring.data() + off, p, r.len);
+                recs.push_back(r);
+                used += r.len;
+        } else {
+                srError("membuf: drop batch of " + to_string(lines));
+        }
+        open.clear();
+        lines = 0;
+}
+
+
+const string &_MemPager::front() const
+{
+        if (recs.empty())
+                return open;
+        if (fresh)
+                return head;
+        const _Rec &r = recs.front();
+        head.clear();
+        if (r.raw == 0)
+                head.assign(ring.data() + r.off, r.len);
+        else if (!zip || zip->inflate(ring.data() + r.off, r.len, r.raw,
+                                      head) == -1)
+                srError("membuf: inflate failed");
+        fresh = true;
+        return head;
+}
+
+
+void _MemPager::pop_front()
+{
+        if (!recs.empty()) {
+                drop();
+        } else if (!open.empty()) {
+                open.clear();
+                lines = 0;
+                ++npop;
+        }
+}
+
+
+int _MemPager::emplace_back(const char *s, size_t n)
+{
+        if (n >= 3 && !memcmp(s, "15,", 3)) {
+                xid.assign(s, n);
+        } else if (open.empty() && !xid.empty()) {
+                open = xid;
+                ++lines;
+        }
+        open.append(s, n);
+        ++lines;
+        const size_t budget = (size_t)cap * SR_MEMBUF_UNIT;
+        if (lines >= SR_MEMBUF_NUM || open.size() * 4 >= budget)
+                seal();
+        return 0;
+}
+
+
+void _MemPager::clear()
+{
+        npop += bsize();
+        recs.clear();
+        open.clear();
+        xid.clear();
+        lines = used = 0;
+        fresh = false;
+}
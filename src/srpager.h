@@ -0,0 +1,317 @@
+#ifndef SRPAGER_H
+#define SRPAGER_H
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define SR_FILEBUF_VER 0x2
+#define SR_FILEBUF_INDEX_SUFFIX ".index"
+#define SR_FILEBUF_JOURNAL_SUFFIX ".journal"
+#define SR_FILEBUF_SEG_SCALE 16
+#define SR_MEMBUF_SCALE 8
+#define SR_MEMBUF_NUM (1 << SR_MEMBUF_SCALE)
+#define SR_MEMBUF_UNIT 64
+
+/**
+ *  \class _Zip
+ *  \brief Raw deflate codec with a preset dictionary.
+ *
+ *  SmartREST requests repeat the same message IDs, device IDs and time
+ *  stamps, priming the compressor with a dictionary, e.g., the registered
+ *  template, lets even the first requests of a batch refer to them. The
+ *  dictionary is identified by its Adler-32 checksum.
+ */
+class _Zip
+{
+public:
+        _Zip();
+        ~_Zip();
+
+        /**
+         *  \brief Set the dictionary, -1 if built without SR_BUF_COMPRESS.
+         */
+        int setDict(const std::string &dict);
+        uint32_t id() const {return dictid;}
+        // Append the compressed [s, s + n) to out.
+        int deflate(const char *s, size_t n, std::string &out);
+        // Append the inflated [s, s + n), which is raw bytes long, to out.
+        int inflate(const char *s, size_t n, size_t raw, std::string &out);
+
+private:
+        _Zip(const _Zip&);
+        _Zip &operator=(const _Zip&);
+        struct _Streams;
+        std::unique_ptr<_Streams> zs;
+        std::string dict;
+        uint32_t dictid;
+};
+
+/**
+ *  \class _Pager
+ *  \brief Capacity limited buffer of SmartREST requests for SrReporter.
+ *
+ *  Requests are buffered in batches, front() returns the oldest batch, and
+ *  pop_front() discards it once it is sent. When the capacity is exhausted,
+ *  the oldest requests are discarded. With setCompression(), requests are
+ *  stored compressed, and the compressed size counts against the capacity.
+ */
+class _Pager
+{
+public:
+        _Pager(uint32_t _cap): cap(_cap), npop(0), zip() {}
+        virtual ~_Pager() {}
+
+        size_t capacity() const {return cap;};
+        void setCapacity(uint32_t _cap) {cap = _cap;};
+        virtual bool empty() const = 0;
+        virtual size_t bsize() const = 0;
+        virtual size_t size() const = 0;
+        /**
+         *  \brief The oldest batch, valid until the pager is modified.
+         */
+        virtual const std::string &front() const = 0;
+        virtual void pop_front() = 0;
+        virtual int emplace_back(const char *s, size_t n) = 0;
+        int emplace_back(const std::string &s) {
+                return emplace_back(s.data(), s.size());
+        }
+        virtual void clear() = 0;
+        /**
+         *  \brief Start a new batch with the next emplace_back().
+         */
+        virtual void cut() = 0;
+        /**
+         *  \brief Number of batches removed from the front so far, by
+         *  pop_front(), clear() or for making room.
+         */
+        uint64_t popped() const {return npop;}
+        /**
+         *  \brief Compress requests buffered from now on with dictionary
+         *  dict, -1 if compression is not supported.
+         */
+        virtual int setCompression(const std::string &dict);
+
+protected:
+        uint32_t cap;
+        uint64_t npop;
+        std::unique_ptr<_Zip> zip;
+};
+
+
+struct _BFHead {
+        _BFHead(): base(0), flag(0), seg(0), pad(0), size(0), cnt(0),
+                   gen(0) {}
+        uint8_t base, flag;
+        uint8_t seg;            // scale of pages per segment file
+        uint8_t pad;
+        uint32_t size, cnt;
+        uint32_t gen;           // generation of the matching journal
+};
+
+
+struct _BFPage {
+        _BFPage(uint32_t idx = 0, uint16_t oft = 0, uint8_t f = 0):
+                index(idx), offset(oft), flag(f), cnt(0) {}
+        uint32_t index;
+        uint16_t offset;
+        uint8_t flag, cnt;
+};
+
+
+/**
+ *  \brief Journal record of a change to the page control blocks.
+ *
+ *  The generation is split into two halves, the high one in what used to be
+ *  padding, so that it does not wrap around in the lifetime of a buffer.
+ */
+struct _BFRec {
+        _BFRec(uint8_t o = 0, uint32_t g = 0, const _BFPage &p = _BFPage()):
+                op(o), flag(p.flag), gen(g), index(p.index),
+                offset(p.offset), genhi(g >> 16) {}
+        uint32_t generation() const {return gen | (uint32_t)genhi << 16;}
+        uint8_t op, flag;
+        uint16_t gen;           // generation of the journal, low half
+        uint32_t index;
+        uint16_t offset, genhi;
+};
+
+
+/**
+ *  \class _MMap
+ *  \brief Shared read-write memory mapping of a whole file.
+ */
+class _MMap
+{
+public:
+        _MMap(): fd(-1), p(NULL), len(0) {}
+        ~_MMap();
+
+        int open(const std::string &fn);
+        size_t fileSize() const;
+        // Resize both the file and the mapping to n bytes.
+        int resize(size_t n);
+        // Write back the range [off, off + n) to the file.
+        void sync(size_t off, size_t n, bool wait);
+        char *data() const {return p;}
+        size_t size() const {return len;}
+
+private:
+        _MMap(const _MMap&);
+        _MMap &operator=(const _MMap&);
+        int fd;
+        char *p;
+        size_t len;
+};
+
+
+/**
+ *  \class _BFPager
+ *  \brief File backed pager.
+ *
+ *  Requests are stored in fixed size pages of memory mapped data files, pages
+ *  of the same batch share the same flag. The data is split into segment
+ *  files of 2^seg pages, the first segment is the file \a fn, the k-th
+ *  segment is \a fn.k. Segments are created and grown as their pages come
+ *  into use, the lowest free page first. Free pages are tracked in a bitmap.
+ *  The page control blocks are persisted as a snapshot in the index file,
+ *  plus an append-only journal of the changes since, so each change writes a
+ *  constant number of bytes. When the journal is full, it is compacted into a
+ *  new snapshot. On start-up, the journal is replayed on top of the snapshot
+ *  of the same generation. Modified ranges are written back with msync,
+ *  asynchronously after each change, and synchronously on compaction and
+ *  destruction. The front batch is read once and cached until the front
+ *  changes.
+ *
+ *  With compression, each emplace_back() is stored as a frame of a NUL byte,
+ *  the dictionary ID, the raw and the compressed length, followed by the
+ *  compressed bytes. Raw requests never contain NUL, so both can be mixed in
+ *  one batch. Frames of another dictionary are dropped with an error.
+ *
+ *  Version 1 buffers, with 16-bit page indices in a single data file, are
+ *  migrated in place on start-up: the data file becomes the first segment
+ *  of 2^16 pages, and only the index is rewritten.
+ */
+class _BFPager: public _Pager
+{
+public:
+        _BFPager(const std::string &fn, uint32_t cap,
+                 unsigned seg = SR_FILEBUF_SEG_SCALE);
+        virtual ~_BFPager();
+
+        virtual bool empty() const {return head.size == 0;}
+        virtual size_t bsize() const {return head.cnt;}
+        virtual size_t size() const {return head.size;}
+        virtual const std::string &front() const;
+        virtual void pop_front();
+        virtual int emplace_back(const char *s, size_t n);
+        using _Pager::emplace_back;
+        virtual void clear();
+        virtual void cut() {split = true;}
+        virtual int setCompression(const std::string &dict) {
+                fresh = false;
+                return _Pager::setCompression(dict);
+        }
+        static size_t pageSize();
+        /**
+         *  \brief Total bytes written to the index and journal files.
+         */
+        uint64_t indexBytes() const {return wbytes;}
+
+private:
+        int push_back(const char *buf, size_t n);
+        uint32_t get_free_page();
+        void mark(size_t index, bool used);
+        int reserve(size_t pages);
+        void trim(size_t pages);
+        size_t mapped() const;
+        std::string segName(size_t k) const;
+        char *page(uint32_t index) const;
+        void syncPage(uint32_t index, size_t off, size_t n);
+        int loadIndex();
+        void replay(int ver);
+        int append(const char *s, size_t n);
+        std::string expand(const std::string &s) const;
+        void log(const _BFRec &rec);
+        void compact();
+
+        std::deque<_BFPage> pcb;
+        std::string fn;
+        _BFHead head;
+        std::vector<uint64_t> bits;     // bitmap of used pages
+        size_t hint;                    // lowest word with a free page
+        size_t jpos;                    // end of the journal
+        uint64_t wbytes;
+        std::string tmp;                // frame of a compressed request
+        mutable std::string buf;        // the front batch
+        mutable bool fresh;             // buf is up to date
+        bool split;                     // next append starts a new batch
+        std::vector<std::unique_ptr<_MMap>> segs;
+        _MMap index;
+        _MMap journal;
+};
+
+
+/**
+ *  \class _MemPager
+ *  \brief Memory backed pager with a byte budget.
+ *
+ *  Request lines are appended to an open batch, which is sealed once it
+ *  holds SR_MEMBUF_NUM lines or a quarter of the budget, and every batch
+ *  starts with the XID line in effect. Sealed batches, compressed with
+ *  setCompression(), are stored back to back in a ring of cap *
+ *  SR_MEMBUF_UNIT bytes, and located by a side index. A batch never wraps
+ *  around the end of the ring, the oldest batches are discarded to make
+ *  room for a new one.
+ */
+class _MemPager: public _Pager
+{
+public:
+        _MemPager(uint32_t _cap): _Pager(_cap), lines(0), used(0),
+                                  fresh(false) {}
+        virtual ~_MemPager() {}
+
+        virtual bool empty() const {return recs.empty() && open.empty();}
+        virtual size_t bsize() const {
+                return recs.size() + (open.empty() ? 0 : 1);
+        }
+        virtual size_t size() const {
+                return (used + open.size() + SR_MEMBUF_UNIT - 1) /
+                        SR_MEMBUF_UNIT;
+        }
+        virtual const std::string &front() const;
+        virtual void pop_front();
+        virtual int emplace_back(const char *s, size_t n);
+        using _Pager::emplace_back;
+        virtual void clear();
+        virtual void cut() {
+                if (!open.empty())
+                        seal();
+        }
+        virtual int setCompression(const std::string &dict) {
+                fresh = false;
+                return _Pager::setCompression(dict);
+        }
+
+private:
+        struct _Rec {
+                size_t off, len;
+                size_t raw;             // inflated length, 0 if not compressed
+        };
+        long alloc(size_t n);
+        void seal();
+        void drop();
+
+        std::vector<char> ring;
+        std::deque<_Rec> recs;          // sealed batches, oldest first
+        std::string open;               // batch being filled
+        std::string xid;                // XID line in effect
+        std::string tmp;
+        size_t lines;                   // lines in the open batch
+        size_t used;                    // bytes of sealed batches
+        mutable std::string head;       // copy of the front batch
+        mutable bool fresh;             // head is up to date
+};
+
+#endif /* SRPAGER_H */
@@ -1,287 +1,147 @@
 #include <algorithm>
-#include <sstream>
-#include <fstream>
+#include <atomic>
 #include <unistd.h>
 #include <cstring>
 #include "srreporter.h"
-#define Q_OK SrQueue<SrNews>::Q_OK
+#include "srpager.h"
 using namespace std;
 
-#define SR_FILEBUF_VER 0x1
-#define SR_FILEBUF_PAGE_BASE 9
-#define SR_FILEBUF_PAGE_SIZE (1<<(SR_FILEBUF_PAGE_BASE+SR_FILEBUF_PAGE_SCALE))
-#define SR_FILEBUF_INDEX_SUFFIX ".index"
-#define SR_MEMBUF_SCALE 8
-#define SR_MEMBUF_NUM (1 << SR_MEMBUF_SCALE)
-#define BASE_PAGE(x) (x & 0x07)
-#define BASE_VER(x) ((x >> 3) & 0x0f)
-#define _BASE (BASE_PAGE(SR_FILEBUF_PAGE_SCALE) | (SR_FILEBUF_VER<<3))
-
-
-struct _BFHead {
-        _BFHead(): base(_BASE), flag(0), size(0), cnt(0), pad2(0) {}
-        uint8_t base, flag;
-        uint16_t size, cnt, pad2;
-};
-
-
-struct _BFPage {
-        _BFPage(uint16_t idx = 0, uint16_t oft = 0, uint8_t f = 0):
-                index(idx), offset(oft), flag(f), cnt(0), pad(0) {}
-        uint16_t index, offset;
-        uint8_t flag, cnt;
-        uint16_t pad;
-};
 
-typedef std::deque<_BFPage> _PCB;
-typedef std::vector<bool> _UFLAG;
+// byte ranges [first, second) of an aggregated request
+typedef std::vector<std::pair<size_t, size_t> > _Spans;
 
-static void readPCB(const string &fn, _BFHead &head, _PCB &pcb, _UFLAG &uflag)
-{
-        ifstream fs(fn, ios::binary);
-        if (!fs.read((char*)&head, sizeof(head)))
-                return;
-        if (BASE_VER(head.base) != SR_FILEBUF_VER ||
-            BASE_PAGE(head.base) != SR_FILEBUF_PAGE_SCALE) {
-                head.cnt = head.size = 0;
-                return;
-        }
-        const size_t sz = head.size;
-        if (uflag.size() < sz)
-                uflag.resize(sz);
-        _BFPage page;
-        uint8_t flag = 2;
-        uint16_t cnt = 0;
-        for (size_t i = 0; fs.read((char*)&page, sizeof(page)) && i < sz; ++i) {
-                pcb.push_back(page);
-                uflag[page.index] = true;
-                cnt += flag == page.flag ? 0 : 1;
-                flag = page.flag;
-        }
-        head.size = pcb.size();
-        head.cnt = cnt;
-}
-
-
-static void writePCB(const string &fn, const _BFHead &head, _PCB &pcb)
-{
-        ofstream out(fn, ios::binary);
-        if (!out.write((const char*)&head, sizeof(head)))
-                return;
-        for (const auto &e: pcb) {
-                if (!out.write((const char*)&e, sizeof(_BFPage)))
-                        break;
-        }
-}
-
-
-static int readPage(ifstream &in, size_t i, char *dest, size_t size)
-{
-        in.seekg(i * SR_FILEBUF_PAGE_SIZE);
-        return in.read(dest, size) ? in.gcount() : -1;
-}
-
-
-static int writePage(ofstream &out, size_t index, const char *buf,
-                     size_t size, size_t offset = 0)
-{
-        out.seekp(index * SR_FILEBUF_PAGE_SIZE + offset);
-        return out.write(buf, size) ? 0 : -1;
-}
-
-
-class _Pager
+class _Aggregator
 {
 public:
-        _Pager(uint16_t _cap): cap(_cap) {}
-        virtual ~_Pager() {}
-
-        size_t capacity() const {return cap;};
-        void setCapacity(uint16_t _cap) {cap = _cap;};
-        virtual bool empty() const = 0;
-        virtual size_t bsize() const = 0;
-        virtual size_t size() const = 0;
-        virtual string front() const = 0;
-        virtual void pop_front() = 0;
-        virtual int emplace_back(const string &s) = 0;
-        virtual void clear() = 0;
-
-protected:
-        uint16_t cap;
-};
-
-
-class _BFPager: public _Pager {
-public:
-        _BFPager(const string &_fn, int c): _Pager(c), fn(_fn), uflag(c) {
-                readPCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb, uflag);
-                if (access(fn.c_str(), F_OK) == -1) ofstream out(fn);
-        }
-        ~_BFPager() {writePCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb);}
-
-        virtual bool empty() const {return head.size == 0;}
-        virtual size_t bsize() const {return head.cnt;}
-        virtual size_t size() const {return head.size;}
-        virtual string front() const {
-                string s;
-                if (pcb.empty())
-                        return s;
-                char buf[SR_FILEBUF_PAGE_SIZE];
-                ifstream in(fn, ios::binary);
-                const auto flag = pcb.front().flag;
-                for (size_t i = 0; i < pcb.size() && flag == pcb[i].flag; ++i) {
-                        const auto offset = pcb[i].offset + 1;
-                        if (readPage(in, pcb[i].index, buf, offset) != offset)
-                                break;
-                        s.append(buf, offset);
-                }
-                return s;
-        };
-        virtual void pop_front() {
-                const auto flag = pcb.front().flag;
-                size_t i = 0;
-                for (; i < pcb.size() && pcb[i].flag == flag; ++i)
-                        uflag[pcb[i].index] = false;
-                pcb.erase(pcb.begin(), pcb.begin() + i);
-                head.size = pcb.size();
-                --head.cnt;
-                writePCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb);
+        _Aggregator(SrQueue<SrNews> &q, const string &xid): q(q), xid(xid),
+                hint(0), bytes(0), records(SR_REPORTER_NUM),
+                linger(SR_REPORTER_VAL) {}
+
+        // Called from any thread, aggregate() reads the policy once per batch.
+        void setPolicy(size_t b, size_t r, int l) {
+                bytes = b;
+                records = max(r, (size_t)1);
+                linger = max(l, 0);
         }
-        virtual int emplace_back(const string &s) {
-                const auto sz = SR_FILEBUF_PAGE_SIZE;
-                if (pcb.empty() || s.size() + pcb.back().offset > sz) {
-                        return push_back(s);
-                } else {
-                        auto &t = pcb.back();
-                        const auto f = t.offset + 1;
-                        ofstream out(fn, ios::binary | ios::in);
-                        if (writePage(out, t.index, s.c_str(), s.size(), f))
-                                return -1;
-                        t.offset += s.size();
-                        writePCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb);
-                        return 0;
-                }
-        }
-        virtual void clear() {
-                pcb.clear();
-                fill(uflag.begin(), uflag.end(), false);
-                head.size = head.cnt = 0;
-                writePCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb);
-                const auto c = cap;
-                if (c < uflag.size()) {
-                        truncate(fn.c_str(), c * SR_FILEBUF_PAGE_SIZE);
-                        uflag.resize(c);
-                        srInfo("filebuf: truncate " + to_string(c));
-                }
+        // Aggregate requests from the queue into one SmartREST request. The
+        // request is built in a buffer reused across calls, and stays valid
+        // until the next call.
+        const string &aggregate();
+        // Ranges of the request to buffer, i.e., lines with SR_PRIO_BUF set
+        // and their XID lines.
+        const _Spans &buffered() const {return spans;}
+        // Hint if aggregate() has requests at hand, and will not wait for
+        // the first one.
+        bool ready() const {return !news.empty() || !q.empty();}
+        // Take over the request and its buffered ranges, e.g., for keeping
+        // it in flight, the next call starts with a fresh buffer.
+        void take(string &s, _Spans &sp) {
+                s.swap(out);
+                sp.swap(spans);
         }
 
 private:
-        virtual int push_back(const string &s) {
-                const auto _cap = cap;
-                if (uflag.size() < _cap) uflag.resize(_cap);
-
-                const uint8_t flag = (pcb.empty() || pcb.back().flag) ? 0 : 1;
-                const auto sz = SR_FILEBUF_PAGE_SIZE;
-                const int N = s.size() / sz;
-                ofstream out(fn, ios::binary | ios::in);
-                const char *buf = s.c_str();
-                for (int i = 0; i < N; ++i) {
-                        const auto index = get_free_page();
-                        if (writePage(out, index, buf + i * sz, sz) == -1)
-                                return -1;
-                        uflag[index] = true;
-                        pcb.emplace_back(index, sz - 1, flag);
-                }
-                const auto c = s.size() & (sz - 1);
-                if (c) {
-                        const auto index = get_free_page();
-                        if (writePage(out, index, buf + N * sz, c) == 0) {
-                                uflag[index] = true;
-                                pcb.emplace_back(index, c - 1, flag);
-                        }
-                }
-                head.size = pcb.size();
-                ++head.cnt;
-                writePCB(fn + SR_FILEBUF_INDEX_SUFFIX, head, pcb);
-                return 0;
-        }
-        uint16_t get_free_page() {
-                uint16_t index = 0;
-                for (; index < cap && uflag[index]; ++index);
-                if (index >= cap) {
-                        index = pcb.front().index;
-                        pop_front();
-                }
-                return index;
+        void append(size_t beg, size_t end) {
+                if (!spans.empty() && spans.back().second == beg)
+                        spans.back().second = end;
+                else
+                        spans.emplace_back(beg, end);
         }
 
-        std::deque<_BFPage> pcb;
-        std::string fn;
-        _BFHead head;
-        std::vector<bool> uflag;
+        SrQueue<SrNews> &q;
+        const string &xid;
+        vector<SrNews> news;    // requests drained but not yet aggregated
+        string out;
+        _Spans spans;
+        size_t hint;            // largest request so far
+        std::atomic<size_t> bytes;
+        std::atomic<size_t> records;
+        std::atomic<int> linger;
 };
 
 
-class _MemPager: public _Pager
+const string &_Aggregator::aggregate()
 {
-public:
-        _MemPager(uint16_t _cap): _Pager(_cap) {}
-        virtual ~_MemPager() {}
-
-        virtual bool empty() const {return mcb.empty();}
-        virtual size_t bsize() const {
-                const auto s = mcb.size();
-                const auto b = s & (SR_MEMBUF_NUM - 1);
-                return (s >> SR_MEMBUF_SCALE) + (b ? 1 : 0);
-        }
-        virtual size_t size() const {return mcb.size();}
-        virtual string front() const {
-                string s;
-                for (size_t i = 0; i < mcb.size() && i < SR_MEMBUF_NUM; ++i)
-                        s += mcb[i];
-                return s;
-        }
-        virtual void pop_front() {
-                auto p = [](const string &T) {return !T.compare(0, 3, "15,");};
-                if (mcb.size() <= SR_MEMBUF_NUM) {
-                        mcb.clear();
-                } else if (p(mcb[SR_MEMBUF_NUM])) {
-                        mcb.erase(mcb.begin(), mcb.begin() + SR_MEMBUF_NUM);
-                } else {
-                        const auto a = mcb.size() - SR_MEMBUF_NUM;
-                        auto it = find_if(mcb.rbegin() + a, mcb.rend(), p);
-                        const auto s = *it;
-                        mcb.erase(mcb.begin(), mcb.begin() + SR_MEMBUF_NUM);
-                        mcb.push_front(s);
+        hint = max(hint, out.size());
+        out.clear();
+        spans.clear();
+        out.reserve(hint);
+        // the policy of this batch
+        const size_t maxb = bytes, maxn = records;
+        const int maxms = linger;
+        string myxid;
+        size_t n = 0, xbeg = 0, xend = 0;
+        bool xbuf = false;      // current XID line is in spans
+        // idle wait for the first request, with no linger the default one,
+        // as waiting for nothing would poll the queue.
+        int ms = maxms ? maxms : SR_REPORTER_VAL;
+        timespec t0;
+        // the batch is closed when either it is full, a request with
+        // SR_PRIO_FLUSH is added, or its first request has waited for
+        // linger, then only immediately available requests are added.
+        for (bool last = false; !last;) {
+                if (news.empty()) {
+                        last = ms == 0;
+                        if (!q.drain(news, maxn - n, ms))
+                                break;
                 }
-        }
-        virtual int emplace_back(const string &s) {
-                auto p = [](const string &T) {return T.compare(0, 3, "15,");};
-                if (mcb.size() >= cap) {
-                        if (p(mcb.front())) {
-                                mcb.pop_front();
-                        } else {
-                                const string front(mcb.front());
-                                mcb.erase(mcb.begin(), mcb.begin() + 2);
-                                if (!mcb.empty() && p(mcb.front()))
-                                        mcb.emplace_front(front);
+                if (n == 0)
+                        clock_gettime(CLOCK_MONOTONIC, &t0);
+                bool full = false;
+                size_t i = 0;
+                for (; i < news.size() && !full; ++i) {
+                        const SrNews &e = news[i];
+                        const string &data = e.data;
+                        const bool alternate = e.prio & SR_PRIO_XID;
+                        const size_t pos = alternate ? data.find(',') : 0;
+                        const char *cxid = alternate ? data.c_str() : xid.c_str();
+                        const size_t len = alternate ? pos : xid.size();
+                        const bool newxid = n == 0 ||
+                                myxid.compare(0, string::npos, cxid, len);
+                        const size_t pos2 = pos ? pos + 1 : 0;
+                        // the request line, plus "15,<xid>" on a switch
+                        const size_t add = data.size() - pos2 + 1 +
+                                (newxid ? len + 4 : 0);
+                        if (n && maxb && out.size() + add > maxb) {
+                                full = true;
+                                break; // left for the next batch
+                        }
+                        if (newxid) {
+                                myxid.assign(cxid, len);
+                                xbeg = out.size();
+                                out.append("15,", 3).append(myxid) += '\n';
+                                xend = out.size();
+                                xbuf = false;
                         }
+                        const size_t beg = out.size();
+                        out.append(data, pos2, data.size() - pos2) += '\n';
+                        if (e.prio & SR_PRIO_BUF) {
+                                if (!xbuf)
+                                        append(xbeg, xend);
+                                xbuf = true;
+                                append(beg, out.size());
+                        }
+                        full = ++n >= maxn || (e.prio & SR_PRIO_FLUSH);
                 }
-                mcb.emplace_back(s);
-                return 0;
+                news.erase(news.begin(), news.begin() + i);
+                if (full)
+                        break;
+                timespec t1;
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                const long d = (t1.tv_sec - t0.tv_sec) * 1000 +
+                        (t1.tv_nsec - t0.tv_nsec) / 1000000;
+                ms = d < maxms ? maxms - d : 0;
         }
-        virtual void clear() {mcb.clear();}
-
-private:
-        deque<string> mcb;
-};
+        return out;
+}
 
 
 SrReporter::SrReporter(const string &s, const string &x, const string &a,
                        SrQueue<SrNews> &out, SrQueue<SrOpBatch> &in,
-                       uint16_t cap, const string fn):
+                       uint32_t cap, const string fn):
         http(new SrNetHttp(s + "/s", "", a)), mqtt(), out(out), in(in), xid(x),
-        ptr(), sleeping(false), isfilebuf(!fn.empty())
+        ptr(), agg(new _Aggregator(out, x)), window(1), sleeping(false),
+        isfilebuf(!fn.empty())
 {
         if (isfilebuf)
                 ptr.reset(new _BFPager(fn, cap));
@@ -293,9 +153,10 @@ SrReporter::SrReporter(const string &s, const string &x, const string &a,
 SrReporter::SrReporter(const string &server, const string &deviceId,
                        const string &x, const string &user, const string &pass,
                        SrQueue<SrNews> &out, SrQueue<SrOpBatch> &in,
-                       uint16_t cap, const string fn):
+                       uint32_t cap, const string fn):
         http(), mqtt(new SrNetMqtt("d:" + deviceId, server)), out(out), in(in),
-        xid(x), ptr(), sleeping(false), isfilebuf(!fn.empty())
+        xid(x), ptr(), agg(new _Aggregator(out, x)), window(1),
+        sleeping(false), isfilebuf(!fn.empty())
 {
         if (isfilebuf)
                 ptr.reset(new _BFPager(fn, cap));
@@ -307,8 +168,16 @@ SrReporter::SrReporter(const string &server, const string &deviceId,
 
 
 SrReporter::~SrReporter() {}
-uint16_t SrReporter::capacity() const {return ptr->capacity();}
-void SrReporter::setCapacity(uint16_t cap) {ptr->setCapacity(cap);}
+uint32_t SrReporter::capacity() const {return ptr->capacity();}
+void SrReporter::setCapacity(uint32_t cap) {ptr->setCapacity(cap);}
+int SrReporter::setCompression(const string &dict)
+{
+        return ptr->setCompression(dict);
+}
+void SrReporter::setBatchPolicy(size_t bytes, size_t records, int linger)
+{
+        agg->setPolicy(bytes, records, linger);
+}
 
 
 int SrReporter::start()
@@ -325,45 +194,39 @@ void SrReporter::mqttSetOpt(int opt, long parameter)
 {
         switch (opt) {
         case SR_MQTTOPT_KEEPALIVE: mqtt->setKeepalive(parameter); break;
+        case SR_MQTTOPT_INFLIGHT: window = max(1L, min(parameter, 4096L));
+                break;
         default: srWarning("reporter: invalid mqtt option " + to_string(opt));
         }
 }
 
 
-static string aggregate(SrQueue<SrNews> &q, _Pager *p, bool isfilebuf,
-                        const string &xid)
+// Put the ranges \a spans of request \a s into the pager. The memory pager
+// keeps one line per entry, whereas the file pager keeps the whole chunk.
+// Requests the pager cannot take, e.g., for lack of disk space, are lost.
+static void buffer(_Pager *p, bool isfilebuf, const string &s,
+                   const _Spans &spans)
 {
-        string s, buf, myxid;
-        SrQueue<SrNews>::Event e;
-        while ((e = q.get(SR_REPORTER_VAL)).second == Q_OK) {
-                const string &data = e.first.data;
-                const bool alternate = e.first.prio & SR_PRIO_XID;
-                const size_t pos = alternate ? data.find(',') : 0;
-                const string cxid = alternate ? data.substr(0, pos) : xid;
-                if (cxid != myxid) { // different XID than before
-                        myxid = cxid;
-                        s += "15," + myxid + '\n';
-                        if (e.first.prio & SR_PRIO_BUF) {
-                                if (isfilebuf)
-                                        buf += "15," + myxid + '\n';
-                                else
-                                        p->emplace_back("15," + myxid + '\n');
-                        }
-                }
-                const size_t pos2 = pos ? pos + 1 : 0;
-                s.append(data, pos2, data.size() - pos2);
-                s += '\n';
-                if (e.first.prio & SR_PRIO_BUF) {
-                        if (isfilebuf) {
-                                buf.append(data, pos2, data.size() - pos2);
-                                buf += '\n';
-                        } else {
-                                p->emplace_back(data.substr(pos2) + '\n');
+        int c = 0;
+        if (isfilebuf && spans.size() == 1) {
+                c = p->emplace_back(s.data() + spans[0].first,
+                                    spans[0].second - spans[0].first);
+        } else if (isfilebuf && !spans.empty()) {
+                string buf;
+                for (auto &e: spans)
+                        buf.append(s, e.first, e.second - e.first);
+                c = p->emplace_back(buf);
+        } else if (!isfilebuf) {
+                for (auto &e: spans) {
+                        for (size_t i = e.first; i < e.second;) {
+                                const size_t j = s.find('\n', i) + 1;
+                                c |= p->emplace_back(s.data() + i, j - i);
+                                i = j;
                         }
                 }
         }
-        if (!buf.empty()) p->emplace_back(buf);
-        return s;
+        if (c == -1)
+                srError("reporter: buffer failed, requests dropped");
 }
 
 
@@ -371,8 +234,8 @@ class MyMqttMsgHandler: public SrMqttAppMsgHandler
 {
 public:
         MyMqttMsgHandler(SrQueue<SrOpBatch>& _in): in(_in) {}
-        virtual void operator()(const SrMqttAppMsg &m) {
-                in.put(SrOpBatch(m.data));
+        virtual void operator()(const SrMqttAppView &v) {
+                in.put(SrOpBatch(string(v.data, v.dlen)));
         }
 private:
         SrQueue<SrOpBatch> &in;
@@ -382,8 +245,9 @@ private:
 class MyMqttDebugHandler: public SrMqttAppMsgHandler
 {
 public:
-        virtual void operator()(const SrMqttAppMsg &m) {
-                srWarning("MQTT err: " + m.topic + ", " + m.data);
+        virtual void operator()(const SrMqttAppView &v) {
+                srWarning("MQTT err: " + string(v.topic, v.tlen) + ", " +
+                          string(v.data, v.dlen));
         }
 };
 
@@ -398,30 +262,196 @@ static int _mqtt_connect(SrNetMqtt *mqtt, bool clean, const string &xid)
 }
 
 
-static int exp_send(void *net, bool ishttp, const string &data,
-                    SrQueue<SrOpBatch> &in, const string &xid)
+// One attempt at sending data, re-connects MQTT on failure.
+static int send(void *net, bool ishttp, const string &data,
+                SrQueue<SrOpBatch> &in, const string &xid)
 {
-        SrNetHttp *http = ishttp ? (SrNetHttp*)net : nullptr;
-        SrNetMqtt *mqtt = !ishttp ? (SrNetMqtt*)net : nullptr;
-        int i;
-        for (i = 0; i < SR_REPORTER_RETRIES; ++i) {
-                if (http && http->post(data) >= 0) {
-                        const string &resp = http->response();
-                        if (!resp.empty()) {
-                                in.put(SrOpBatch(resp));
-                                http->clear();
-                        }
-                        break;
+        if (ishttp) {
+                SrNetHttp *http = (SrNetHttp*)net;
+                if (http->post(data) < 0)
+                        return -1;
+                const string &resp = http->response();
+                if (!resp.empty()) {
+                        in.put(SrOpBatch(resp));
+                        http->clear();
+                }
+                return 0;
+        }
+        SrNetMqtt *mqtt = (SrNetMqtt*)net;
+        if (mqtt->publish("s/ul", data, 2) == 0)
+                return 0;
+        _mqtt_connect(mqtt, false, xid);
+        return -1;
+}
+
+
+static time_t now()
+{
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec;
+}
+
+
+// Retry schedule of a failed send. The n-th retry is due after a random
+// wait between 2^(n-2) and 2^(n-1) seconds, the jitter keeps devices
+// recovering from the same outage from retrying in lock step. A request is
+// given up after SR_REPORTER_RETRIES attempts, the schedule then still waits
+// the longest delay before it starts over.
+class _Backoff
+{
+public:
+        _Backoff(): n(0), t(0) {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                seed = ts.tv_nsec ^ getpid();
+        }
+        bool active() const {return n > 0 || ms() < t;}
+        bool due() const {return ms() >= t;}
+        // Schedule the next retry, false if all retries are exhausted.
+        bool fail() {
+                const bool more = ++n < SR_REPORTER_RETRIES;
+                const long d = 1000L << (max(min(n, SR_REPORTER_RETRIES - 1),
+                                             1) - 1);
+                t = ms() + d / 2 + rand_r(&seed) % (d / 2 + 1);
+                if (!more)
+                        n = 0;
+                return more;
+        }
+        void reset() {n = 0; t = 0;}
+        int attempts() const {return n;}
+        // Sleep until the next attempt is due, at most lim milliseconds.
+        void wait(long long lim) const {
+                const long long d = min(t - ms(), lim);
+                if (d > 0) usleep(d * 1000);
+        }
+
+private:
+        static long long ms() {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+        }
+        int n;                  // failed attempts so far
+        long long t;            // time of the next attempt
+        unsigned seed;
+};
+
+
+struct _Inflight {
+        _Inflight(int p): packet(p), t(now()) {}
+        int packet;             // packet ID, 0 if never published
+        time_t t;               // time of the last publish
+        string data;            // the published request
+        _Spans spans;           // ranges of data with SR_PRIO_BUF set
+};
+
+
+// Re-connect and re-publish all requests in flight in order, with the DUP
+// flag set for already published ones. Requests acknowledged behind an older
+// unacknowledged one are released first, and not sent again.
+static int resend(SrNetMqtt *mqtt, deque<_Inflight> &win, const string &xid)
+{
+        auto acked = [mqtt](const _Inflight &e) {
+                return e.packet && !mqtt->isInflight(e.packet);
+        };
+        win.erase(remove_if(win.begin(), win.end(), acked), win.end());
+        if (_mqtt_connect(mqtt, false, xid) == -1)
+                return -1;
+        for (auto &e: win) {
+                const char dup = e.packet ? 8 : 0;
+                const int c = mqtt->publishAsync("s/ul", e.data, 2 | dup,
+                                                 e.packet);
+                if (c == -1)
+                        return -1;
+                e.packet = c;
+                e.t = now();
+        }
+        return mqtt->flush();
+}
+
+
+// Pipelined reporter loop for MQTT. Up to window aggregated requests are
+// published without waiting for their PUBACK, and released in order once
+// acknowledged. Publishes are queued while more requests are at hand, and
+// written at once. The buffered part of a request enters the pager only when
+// the request cannot be delivered, or when the reporter is sleeping. Any
+// backlog in the pager is sent stop-and-wait before new requests. While a
+// retry is scheduled, requests are left in the egress queue.
+static void pipeline(SrNetMqtt *mqtt, _Pager *pager, _Aggregator *agg,
+                     SrQueue<SrOpBatch> &in, const string &xid,
+                     const bool &sleeping, size_t window)
+{
+        deque<_Inflight> win;
+        _Backoff retry;
+        auto recover = [&]() {
+                if (resend(mqtt, win, xid) == 0) {
+                        retry.reset();
+                        return;
+                } else if (retry.fail()) {
+                        return;
                 }
-                if (mqtt) {
-                        if(mqtt->publish("s/ul", data, 2))
-                                _mqtt_connect(mqtt, false, xid);
+                srError("reporter: drop " + to_string(win.size()) +
+                        " requests in flight");
+                for (auto &e: win)
+                        buffer(pager, false, e.data, e.spans);
+                win.clear();
+                mqtt->clearInflight();
+        };
+        bool idle = true;
+        while (true) {
+                if (retry.active()) {
+                        if (retry.due())
+                                recover();
                         else
-                                break;
+                                retry.wait(1000);
+                        continue;
+                }
+                // block on the socket only when there is nothing else to do,
+                // otherwise PUBACKs are collected once the window is full.
+                if ((idle || win.size() >= window) && mqtt->yield(1000) == -1) {
+                        recover();
+                        continue;
+                }
+                while (!win.empty() && !mqtt->isInflight(win.front().packet))
+                        win.pop_front();
+                if (!win.empty() && now() - win.front().t > mqtt->timeout()) {
+                        srWarning("reporter: PUBACK timeout");
+                        recover();
+                        continue;
+                }
+                if (win.size() >= window)
+                        continue;
+                if (!pager->empty() && !sleeping) {
+                        idle = !win.empty();
+                        if (idle) continue;
+                        const size_t bsize = pager->bsize();
+                        if (send(mqtt, false, pager->front(), in, xid) == 0) {
+                                retry.reset();
+                                if (bsize <= 1) pager->clear();
+                                else pager->pop_front();
+                        } else if (!retry.fail()) {
+                                // the batch stays in the pager for later
+                                srError("reporter: give up after " +
+                                        to_string(SR_REPORTER_RETRIES) +
+                                        " retries");
+                        }
+                        continue;
+                }
+                const string &data = agg->aggregate();
+                idle = data.empty();
+                if (sleeping) {
+                        buffer(pager, false, data, agg->buffered());
+                } else if (!idle) {
+                        const int c = mqtt->publishAsync("s/ul", data);
+                        win.emplace_back(max(c, 0));
+                        agg->take(win.back().data, win.back().spans);
+                        // with more requests at hand, the publish is
+                        // written together with the next ones
+                        if (c == -1 || (!agg->ready() && mqtt->flush() == -1))
+                                recover();
                 }
-                ::sleep(1 << i);
         }
-        return i < SR_REPORTER_RETRIES ? 0 : -1;
 }
 
 
@@ -445,36 +475,81 @@ void *SrReporter::func(void *arg)
         }
         if (rpt->isfilebuf) {
                 const string s = "filebuf: " + to_string(SR_FILEBUF_VER);
-                srNotice(s + ", " + to_string(SR_FILEBUF_PAGE_SIZE));
+                srNotice(s + ", " + to_string(_BFPager::pageSize()));
         }
         srInfo("reporter: buf capacity: " + to_string(pager->capacity()));
-        size_t bsize = pager->bsize();
-        string data = pager->front();
-        string aggre = aggregate(rpt->out, pager, rpt->isfilebuf, rpt->xid);
-        if (bsize <= 1) data += aggre;
-        if (!data.empty()) {
-                rc = exp_send(net, ishttp, data, rpt->in, rpt->xid);
-                if (rc == 0) {
-                        if (bsize <= 1) pager->clear();
-                        else pager->pop_front();
-                }
+        if (rpt->mqtt && rpt->window > 1 && !rpt->isfilebuf) {
+                srInfo("reporter: inflight window: " + to_string(rpt->window));
+                pipeline(rpt->mqtt.get(), pager, rpt->agg.get(), rpt->in, rpt->xid,
+                         rpt->sleeping, rpt->window);
+                return NULL;
         }
+        _Aggregator *agg = rpt->agg.get();
+        _Backoff retry;
+        string data;            // the request being retried
+        const string *req = &data;
+        uint64_t seq = 0;       // pager->popped() before *req was taken
+        size_t n = 0;           // pager batches covered by *req
         srInfo("reporter: listening...");
-        while (true) {
-                // pre-fetching
-                bsize = pager->bsize();
-                data = pager->front();
-                if (rpt->mqtt && rpt->mqtt->yield(1000) == -1)
+        for (bool first = true; true; first = false) {
+                // while a retry is scheduled, the connection is only touched
+                // by the retry itself.
+                if (!first && rpt->mqtt && rpt->mqtt->yield(1000) == -1 &&
+                    !retry.active())
                         _mqtt_connect(rpt->mqtt.get(), false, rpt->xid);
-                aggre = aggregate(rpt->out, pager, rpt->isfilebuf, rpt->xid);
-                if (bsize <= 1) data += aggre;
-                // sleeping mode
-                if (rpt->sleeping || data.empty()) continue;
-                // exponential wait
-                rc = exp_send(net, ishttp, data, rpt->in, rpt->xid);
+                if (retry.active() && rpt->sleeping) {
+                        const string &aggre = agg->aggregate();
+                        buffer(pager, rpt->isfilebuf, aggre, agg->buffered());
+                        continue;
+                } else if (retry.active()) {
+                        // requests stay in the egress queue meanwhile
+                        if (!retry.due()) {
+                                retry.wait(1000);
+                                continue;
+                        }
+                } else {
+                        const string &aggre = agg->aggregate();
+                        // pre-fetching, before the new request joins the
+                        // pager. The pager caches its front, so this is only
+                        // a copy.
+                        const size_t bsize = pager->bsize();
+                        seq = pager->popped();
+                        if (rpt->sleeping || bsize == 0)
+                                data.clear();
+                        else
+                                data = pager->front();
+                        buffer(pager, rpt->isfilebuf, aggre, agg->buffered());
+                        // send the aggregated request as is, unless appended
+                        // to the pager's, then it covers the whole pager.
+                        n = 1;
+                        if (bsize <= 1) {
+                                if (!data.empty()) data += aggre;
+                                n = pager->popped() - seq + pager->bsize();
+                        }
+                        req = data.empty() ? &aggre : &data;
+                        // sleeping mode
+                        if (rpt->sleeping || req->empty()) continue;
+                }
+                rc = send(net, ishttp, *req, rpt->in, rpt->xid);
                 if (rc == 0) {
-                        if (bsize <= 1) pager->clear();
-                        else pager->pop_front();
+                        retry.reset();
+                        // batches dropped for making room are already gone
+                        for (uint64_t i = pager->popped() - seq; i < n &&
+                                     !pager->empty(); ++i)
+                                pager->pop_front();
+                        if (pager->empty())
+                                pager->clear();
+                } else if (retry.fail()) {
+                        // keep later requests out of the batches to release
+                        if (req != &data)
+                                data = *req;
+                        req = &data;
+                        pager->cut();
+                        srWarning("reporter: retry " +
+                                  to_string(retry.attempts()));
+                } else {
+                        srError("reporter: give up after " +
+                                to_string(SR_REPORTER_RETRIES) + " retries");
                 }
         }
         return NULL;
@@ -1,7 +1,153 @@
+#include <algorithm>
 #include "srtimer.h"
+using namespace std;
+
+#define NPOS ((size_t)-1)
 
 
 bool operator<=(const timespec &l, const timespec &r)
 {
         return l.tv_sec==r.tv_sec ? l.tv_nsec<=r.tv_nsec : l.tv_sec<=r.tv_sec;
 }
+
+
+static bool before(const SrTimer *l, const SrTimer *r)
+{
+        return !(r->fireTime() <= l->fireTime());
+}
+
+
+SrTimer::~SrTimer()
+{
+        if (q) q->detach(this);
+}
+
+
+SrTimer &SrTimer::operator=(const SrTimer &t)
+{
+        if (this == &t)
+                return *this;
+        cb = t.cb;
+        val = t.val;
+        if (t.active) {
+                beg = t.beg;
+                end = t.end;
+                active = true;
+                if (q) q->schedule(this);
+        } else {
+                stop();
+        }
+        return *this;
+}
+
+
+void SrTimer::start()
+{
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &beg);
+        end.tv_sec = beg.tv_sec + val / 1000;
+        end.tv_nsec = beg.tv_nsec + (val % 1000) * 1000000;
+        if (end.tv_nsec >= 1000000000) {
+                ++end.tv_sec;
+                end.tv_nsec -= 1000000000;
+        }
+        active = true;
+        if (q) q->schedule(this);
+}
+
+
+void SrTimer::stop()
+{
+        active = false;
+        if (q) q->remove(this);
+}
+
+
+SrTimerQueue::~SrTimerQueue()
+{
+        for (size_t i = 0; i < all.size(); ++i) {
+                all[i]->q = NULL;
+                all[i]->pos = NPOS;
+        }
+}
+
+
+void SrTimerQueue::add(SrTimer &timer)
+{
+        if (timer.q == this)    // adding the same timer again is a no-op
+                return;
+        if (timer.q)
+                timer.q->detach(&timer);
+        timer.q = this;
+        all.push_back(&timer);
+        if (timer.active)
+                schedule(&timer);
+}
+
+
+SrTimer *SrTimerQueue::pop()
+{
+        SrTimer *t = heap[0];
+        remove(t);
+        return t;
+}
+
+
+void SrTimerQueue::schedule(SrTimer *t)
+{
+        if (t->pos == NPOS) {
+                heap.push_back(t);
+                t->pos = heap.size() - 1;
+                up(t->pos);
+        } else {                // re-started, possibly with a new interval
+                up(t->pos);
+                down(t->pos);
+        }
+}
+
+
+void SrTimerQueue::remove(SrTimer *t)
+{
+        const size_t i = t->pos;
+        if (i == NPOS)
+                return;
+        t->pos = NPOS;
+        SrTimer *last = heap.back();
+        heap.pop_back();
+        if (i < heap.size()) {
+                place(i, last);
+                up(i);
+                down(last->pos);
+        }
+}
+
+
+void SrTimerQueue::detach(SrTimer *t)
+{
+        remove(t);
+        all.erase(std::find(all.begin(), all.end(), t));
+        t->q = NULL;
+}
+
+
+void SrTimerQueue::up(size_t i)
+{
+        SrTimer *t = heap[i];
+        for (size_t p; i > 0 && before(t, heap[p = (i - 1) / 2]); i = p)
+                place(i, heap[p]);
+        place(i, t);
+}
+
+
+void SrTimerQueue::down(size_t i)
+{
+        SrTimer *t = heap[i];
+        const size_t n = heap.size();
+        for (size_t c; (c = 2 * i + 1) < n; i = c) {
+                if (c + 1 < n && before(heap[c + 1], heap[c]))
+                        ++c;
+                if (!before(heap[c], t))
+                        break;
+                place(i, heap[c]);
+        }
+        place(i, t);
+}
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstring>
+#include "srtopictrie.h"
+using namespace std;
+
+
+static inline uint64_t edge(uint32_t node, uint32_t level)
+{
+        return (uint64_t)node << 32 | level;
+}
+
+
+static void add(vector<_TopicTrie::Handler> &v, _TopicTrie::Handler h)
+{
+        if (find(v.begin(), v.end(), h) == v.end())
+                v.push_back(h);
+}
+
+
+uint32_t _TopicTrie::child(uint32_t node, const string &level)
+{
+        const auto id = levels.emplace(level, levels.size()).first->second;
+        const auto it = edges.find(edge(node, id));
+        if (it != edges.end())
+                return it->second;
+        nodes.emplace_back();
+        edges[edge(node, id)] = nodes.size() - 1;
+        return nodes.size() - 1;
+}
+
+
+void _TopicTrie::add(const string &filter, Handler h)
+{
+        uint32_t node = 0;
+        vector<Handler> *v = NULL;
+        for (size_t i = 0; v == NULL;) {
+                const size_t j = filter.find('/', i);
+                const string level = filter.substr(i, j - i);
+                if (level == "#") {
+                        v = &nodes[node].multi;
+                        break;
+                } else if (level == "+") {
+                        if (nodes[node].plus == 0) {
+                                nodes.emplace_back();
+                                nodes[node].plus = nodes.size() - 1;
+                        }
+                        node = nodes[node].plus;
+                } else {
+                        node = child(node, level);
+                }
+                if (j == string::npos)
+                        v = &nodes[node].hdls;
+                i = j + 1;
+        }
+        if (h == NULL)
+                v->clear();
+        else
+                ::add(*v, h);
+}
+
+
+// Match the levels from t on, t is NULL after the last level.
+void _TopicTrie::walk(uint32_t node, const char *t, const char *end,
+                      vector<Handler> &out) const
+{
+        const _Node &e = nodes[node];
+        const bool wild = node || t == NULL || t == end || *t != '$';
+        if (wild) {
+                for (auto h: e.multi)
+                        ::add(out, h);
+        }
+        if (t == NULL) {
+                for (auto h: e.hdls)
+                        ::add(out, h);
+                return;
+        }
+        const char *p = (const char*)memchr(t, '/', end - t);
+        const char *next = p ? p + 1 : NULL;
+        if (p == NULL)
+                p = end;
+        key.assign(t, p - t);
+        const auto it = levels.find(key);
+        if (it != levels.end()) {
+                const auto c = edges.find(edge(node, it->second));
+                if (c != edges.end())
+                        walk(c->second, next, end, out);
+        }
+        if (wild && e.plus)
+                walk(e.plus, next, end, out);
+}
+
+
+void _TopicTrie::match(const char *t, size_t n, vector<Handler> &out) const
+{
+        out.clear();
+        walk(0, t, t + n, out);
+}
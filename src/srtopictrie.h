@@ -0,0 +1,59 @@
+#ifndef SRTOPICTRIE_H
+#define SRTOPICTRIE_H
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+class SrMqttAppMsgHandler;
+
+/**
+ *  \class _TopicTrie
+ *  \brief Router from MQTT topic names to the handlers of matching topic
+ *  filters.
+ *
+ *  Filters are split into levels on '/', each distinct level string is
+ *  interned once as an integer ID, and an edge from a node to its child is
+ *  looked up by the pair of node and level ID. Every node has an own child
+ *  for the single-level wildcard '+', and a list of handlers for the
+ *  multi-level wildcard '#' below it. Matching a topic thus visits each
+ *  level once per matching wildcard branch, independent of the number of
+ *  filters. As required by MQTT, wildcards at the first level do not match
+ *  topic names starting with '$'.
+ */
+class _TopicTrie
+{
+public:
+        typedef SrMqttAppMsgHandler *Handler;
+
+        _TopicTrie(): nodes(1) {}
+
+        /**
+         *  \brief Add handler \a h to filter \a filter, NULL removes all
+         *  handlers of \a filter.
+         */
+        void add(const std::string &filter, Handler h);
+        /**
+         *  \brief Collect the handlers of all filters matching topic name
+         *  [t, t + n) into \a out, each handler at most once.
+         */
+        void match(const char *t, size_t n, std::vector<Handler> &out) const;
+
+private:
+        struct _Node {
+                _Node(): plus(0) {}
+                uint32_t plus;                  // child for '+', 0 if none
+                std::vector<Handler> hdls;      // of the filter ending here
+                std::vector<Handler> multi;     // of the filter + "/#"
+        };
+        uint32_t child(uint32_t node, const std::string &level);
+        void walk(uint32_t node, const char *t, const char *end,
+                  std::vector<Handler> &out) const;
+
+        std::vector<_Node> nodes;               // nodes[0] is the root
+        std::unordered_map<std::string, uint32_t> levels;
+        std::unordered_map<uint64_t, uint32_t> edges;
+        mutable std::string key;                // level under lookup
+};
+
+#endif /* SRTOPICTRIE_H */
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <cstdlib>
+#include <map>
+#include <time.h>
+#include <sragent.h>
+using namespace std;
+
+static const int NREC = 100000;
+static const int NRUN = 20;
+static const uint16_t ids[] = {
+        102, 151, 153, 800, 802, 805, 809, 812, 813, 814, 815, 816, 831, 836
+};
+static const int NIDS = sizeof(ids) / sizeof(ids[0]);
+
+
+static double now()
+{
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+class Counter: public AbstractMsgHandler
+{
+public:
+        Counter(): n(0), t0(0) {}
+        void operator()(SrRecord &r, SrAgent &agent) {
+                (void)agent;
+                if (n++ == 0) t0 = now();       // exclude the agent's sleep
+                if (n < NREC) return;
+                cerr << "agent: " << (now() - t0) * 1e9 / NREC
+                     << " ns/record" << endl;
+                exit(0);
+        }
+        virtual ~Counter() {}
+        int n;
+        double t0;
+};
+
+
+int main()
+{
+        string batch;
+        for (int i = 0; i < NREC; ++i)
+                batch += to_string(ids[i % NIDS]) + ",12345,payload\n";
+        vector<SrRecord> recs(NIDS);
+        for (int i = 0; i < NIDS; ++i) {
+                SrLexer::SrToken tok(SrLexer::SR_INT, to_string(ids[i]));
+                recs[i].push_back(tok);
+        }
+        Counter counter;
+        SrAgent agent("", "", NULL, NULL);
+
+        map<SrAgent::MsgID, SrMsgHandler*> m;
+        map<pair<SrAgent::MsgXID, SrAgent::MsgID>, SrMsgHandler*> xm;
+        SrMsgTable<SrMsgHandler> t;
+        SrXMsgTable<SrMsgHandler> xt;
+        for (int i = 0; i < NIDS; ++i) {
+                m[ids[i]] = &counter;
+                t.set(ids[i], &counter);
+                for (SrAgent::MsgXID x = 100; x < 110; ++x) {
+                        xm[make_pair(x, ids[i])] = &counter;
+                        xt.set(x, ids[i], &counter);
+                }
+        }
+
+        // lookups only, the records are parsed once up front
+        size_t hit = 0;
+        double t0 = now();
+        for (int k = 0; k < NRUN; ++k) {
+                for (int i = 0; i < NREC; ++i) {
+                        const SrAgent::MsgID j = recs[i % NIDS].asMsgId();
+                        auto it = m.find(j);
+                        hit += it != m.end() && it->second;
+                        auto xit = xm.find(make_pair(100 + i % 10, j));
+                        hit += xit != xm.end() && xit->second;
+                }
+        }
+        double t1 = now();
+        for (int k = 0; k < NRUN; ++k) {
+                for (int i = 0; i < NREC; ++i) {
+                        const SrAgent::MsgID j = recs[i % NIDS].asMsgId();
+                        hit += t.find(j) != NULL;
+                        hit += xt.find(100 + i % 10, j) != NULL;
+                }
+        }
+        double t2 = now();
+        const double n = NRUN * NREC;
+        cerr << "std::map: " << (t1 - t0) * 1e9 / n << " ns/record" << endl;
+        cerr << "SrMsgTable: " << (t2 - t1) * 1e9 / n << " ns/record" << endl;
+        if (hit != 4 * n) return 1;
+
+        // end-to-end through the agent, same harness as test_msghandler
+        for (int i = 0; i < NIDS; ++i)
+                agent.addMsgHandler(ids[i], &counter);
+        SrOpBatch op;
+        op.data = batch;
+        agent.ingress.put(op);
+        agent.loop();
+        return 0;
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+#include <time.h>
+#include "../src/srpager.h"
+using namespace std;
+
+static const int CAP = 4096;
+static const int N = 20000;
+
+
+static double now()
+{
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main()
+{
+        char dir[] = "/tmp/bench_pagerXXXXXX";
+        if (!mkdtemp(dir))
+                return 1;
+        const string fn = string(dir) + "/buf";
+        const string line = "15,100\n200,c8y_Temperature,T,25.3,2016-01-01\n";
+        const size_t ps = _BFPager::pageSize();
+        cerr << CAP << " pages of " << ps << " bytes, " << N << " batches"
+             << endl;
+        {
+                _BFPager p(fn, CAP);
+                string s;
+                for (size_t j = 0; j < 3 * ps / 2; j += line.size())
+                        s += line;
+                const int step = CAP / 8;
+                uint64_t w = p.indexBytes();
+                double t0 = now();
+                for (int i = 0; i < N; ++i) {
+                        p.emplace_back(s);
+                        if ((i + 1) % step == 0 && i < CAP) {
+                                const uint64_t d = p.indexBytes() - w;
+                                cerr << "index at " << p.size() << " pages: "
+                                     << d / step << " bytes/batch" << endl;
+                                w = p.indexBytes();
+                        }
+                }
+                double t1 = now();
+                cerr << "buffer: " << N / (t1 - t0) << " batches/s" << endl;
+                size_t n = 0;
+                t0 = now();
+                for (int i = 0; i < N; ++i)     // idle reporter loop
+                        n += p.front().size();
+                t1 = now();
+                cerr << "front: " << N / (t1 - t0) << " calls/s" << endl;
+                n = 0;
+                t0 = now();
+                while (!p.empty()) {
+                        n += p.front().size();
+                        p.pop_front();
+                }
+                t1 = now();
+                cerr << "catch-up: " << n / (t1 - t0) / 1e6 << " MB/s" << endl;
+        }
+        {       // realistic requests, compressed
+                _BFPager p(fn, CAP);
+                p.setCompression("10,100,POST,/measurement/measurements,"
+                                 "c8y_Temperature,T,C\n");
+                vector<string> v(16, "15,100\n");
+                for (size_t i = 0; i < v.size(); ++i) {
+                        for (int j = 0; v[i].size() < 3 * ps / 2; ++j) {
+                                v[i] += "100,2016-01-01T12:" + to_string(i) +
+                                        ":" + to_string(j % 60) + ".123+01:00,"
+                                        + to_string(1000 + j) + ",25." +
+                                        to_string(j * 7 % 100) + "\n";
+                        }
+                }
+                const int M = CAP / 2;
+                double t0 = now();
+                for (int i = 0; i < M; ++i)
+                        p.emplace_back(v[i % v.size()]);
+                double t1 = now();
+                cerr << "compressed buffer: " << M / (t1 - t0)
+                     << " batches/s, " << (double)p.size() / M
+                     << " pages/batch" << endl;
+                size_t n = 0;
+                t0 = now();
+                while (!p.empty()) {
+                        n += p.front().size();
+                        p.pop_front();
+                }
+                t1 = now();
+                cerr << "compressed catch-up: " << n / (t1 - t0) / 1e6
+                     << " MB/s" << endl;
+        }
+        {
+                _MemPager p(CAP * 64);
+                const int M = N * 50;
+                double t0 = now();
+                p.emplace_back("15,100\n");
+                for (int i = 0; i < M; ++i)
+                        p.emplace_back(line.data() + 7, line.size() - 7);
+                double t1 = now();
+                cerr << "membuf: " << M / (t1 - t0) << " lines/s" << endl;
+                size_t n = 0;
+                t0 = now();
+                while (!p.empty()) {
+                        n += p.front().size();
+                        p.pop_front();
+                }
+                t1 = now();
+                cerr << "membuf catch-up: " << n / (t1 - t0) / 1e6 << " MB/s"
+                     << endl;
+        }
+        unlink(fn.c_str());
+        unlink((fn + SR_FILEBUF_INDEX_SUFFIX).c_str());
+        unlink((fn + SR_FILEBUF_JOURNAL_SUFFIX).c_str());
+        rmdir(dir);
+        return 0;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <srqueue.h>
+#include <srringqueue.h>
+using namespace std;
+
+static const int P = 4;
+static const int N = 200000;
+
+
+static double now()
+{
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+template<typename Q> static void *producer(void *arg)
+{
+        Q *q = (Q*)arg;
+        const string s = "200,c8y_Temperature,T,25.3";
+        for (int i = 0; i < N; ++i)
+                while (q->put(s) == -1)
+                        sched_yield();
+        return NULL;
+}
+
+
+template<typename Q> static double run(Q &q)
+{
+        pthread_t tids[P];
+        const double t0 = now();
+        for (int i = 0; i < P; ++i)
+                pthread_create(&tids[i], NULL, producer<Q>, &q);
+        for (int i = 0; i < P * N;)
+                i += q.get().second == Q::Q_OK;
+        const double t1 = now();
+        for (int i = 0; i < P; ++i)
+                pthread_join(tids[i], NULL);
+        return P * N / (t1 - t0);
+}
+
+
+static double runDrain(SrQueue<string> &q)
+{
+        pthread_t tids[P];
+        vector<string> v;
+        const double t0 = now();
+        for (int i = 0; i < P; ++i)
+                pthread_create(&tids[i], NULL, producer<SrQueue<string> >, &q);
+        for (size_t i = 0; i < P * N; v.clear())
+                i += q.drain(v, 512, -1);
+        const double t1 = now();
+        for (int i = 0; i < P; ++i)
+                pthread_join(tids[i], NULL);
+        return P * N / (t1 - t0);
+}
+
+
+int main()
+{
+        SrQueue<string> q1;
+        SrRingQueue<string> q2(4096);
+        cerr << P << " producers, 1 consumer, " << N << " puts each" << endl;
+        cerr << "SrQueue: " << run(q1) / 1e6 << " M/s" << endl;
+        cerr << "SrQueue drain: " << runDrain(q1) / 1e6 << " M/s" << endl;
+        cerr << "SrRingQueue: " << run(q2) / 1e6 << " M/s" << endl;
+        return 0;
+}
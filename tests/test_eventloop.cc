@@ -0,0 +1,83 @@
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <unistd.h>
+#include <pthread.h>
+#include <sragent.h>
+using namespace std;
+
+const int val = 100;
+static int pipefd[2];
+static bool gotFd = false, gotMsg = false;
+
+
+class FdCallback: public SrFdHandler
+{
+public:
+        void operator()(int fd, uint32_t events, SrAgent &agent) {
+                char c;
+                assert(fd == pipefd[0] && (events & EPOLLIN));
+                assert(read(fd, &c, 1) == 1 && c == 'x');
+                gotFd = true;
+        }
+};
+
+
+class MsgCallback: public SrMsgHandler
+{
+public:
+        void operator()(SrRecord &r, SrAgent &agent) {
+                assert(r.asMsgId() == 151 && gotFd);
+                gotMsg = true;
+        }
+};
+
+
+class TimerCallback: public SrTimerHandler
+{
+public:
+        void operator()(SrTimer &timer, SrAgent &agent) {
+                const timespec &ft = timer.fireTime();
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                const long late = (ts.tv_sec - ft.tv_sec) * 1000 +
+                        (ts.tv_nsec - ft.tv_nsec) / 1000000;
+                assert(late < 50);
+                assert(gotFd && gotMsg);
+                cerr << "OK!" << endl;
+                exit(0);
+        }
+};
+
+
+static void *producer(void *arg)
+{
+        SrAgent *agent = (SrAgent*)arg;
+        usleep(10 * 1000);
+        assert(write(pipefd[1], "x", 1) == 1);
+        usleep(10 * 1000);
+        SrOpBatch op;
+        op.data = "151,329,payload";
+        agent->ingress.put(op);
+        return NULL;
+}
+
+
+int main()
+{
+        cerr << "Test SrAgent eventLoop: ";
+        SrAgent agent("", "", NULL, NULL);
+        assert(pipe(pipefd) == 0);
+        FdCallback fcb;
+        MsgCallback mcb;
+        TimerCallback tcb;
+        assert(agent.addFdHandler(pipefd[0], &fcb) == 0);
+        agent.addMsgHandler(151, &mcb);
+        SrTimer timer(val, &tcb);
+        agent.addTimer(timer);
+        timer.start();
+        pthread_t tid;
+        pthread_create(&tid, NULL, producer, &agent);
+        agent.eventLoop();
+        return 1;
+}
@@ -26,6 +26,48 @@ int main()
         assert(tok.first == SrLexer::SR_NONE && tok.second == "");
         tok = lex.next();
         assert(tok.first == SrLexer::SR_EOB && tok.second == "");
+
+        SrLexer lex2(s.c_str(), s.size());
+        SrLexer::SrSpan sp = lex2.scan();
+        assert(sp.type == SrLexer::SR_INT && sp.pos == 0 && sp.len == 3);
+        assert(lex2.data() == s.c_str());
+        sp = lex2.scan();
+        assert(sp.type == SrLexer::SR_STRING && sp.esc);
+        assert(sp.pos == 6 && sp.len == 8);
+        string v;
+        lex2.value(sp, v);
+        assert(v == "ab cc \"");
+        sp = lex2.scan();
+        assert(sp.type == SrLexer::SR_FLOAT && !sp.esc);
+        assert(s.compare(sp.pos, sp.len, "-.9") == 0);
+        assert(lex2.scan().type == SrLexer::SR_NEWLINE);
+
+        // tokens crossing the 64-byte blocks of the structural index
+        const string u = "+59, \"ab,\n \"\"\" ,-.9e,\t12.5\n";
+        for (size_t pad = 0; pad < 64; ++pad) {
+                string b(pad, ' ');
+                for (int i = 0; i < 9; ++i) b += u;
+                b += "\"x\"\"";
+                lex2.reset(b.c_str(), b.size());
+                for (int i = 0; i < 9; ++i) {
+                        const size_t off = pad + i * u.size();
+                        tok = lex2.next();
+                        assert(tok.first == SrLexer::SR_INT);
+                        assert(tok.second == "+59" && lex2.start == off);
+                        tok = lex2.next();
+                        assert(tok.first == SrLexer::SR_STRING);
+                        assert(tok.second == "ab,\n \"" && lex2.end == off + 14);
+                        tok = lex2.next();
+                        assert(tok.first == SrLexer::SR_STRING);
+                        assert(tok.second == "-.9e");
+                        tok = lex2.next();
+                        assert(tok.first == SrLexer::SR_FLOAT);
+                        assert(tok.second == "12.5" && lex2.start == off + 22);
+                        assert(lex2.next().first == SrLexer::SR_NEWLINE);
+                }
+                tok = lex2.next();
+                assert(tok.first == SrLexer::SR_ERROR && tok.second == "x\"");
+        }
         cerr << "OK!" << endl;
         return 0;
 }
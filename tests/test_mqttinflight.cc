@@ -0,0 +1,228 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <srnetmqtt.h>
+using namespace std;
+
+static const int N = 5;
+static int lfd;
+static vector<int> ids;
+
+
+static bool readFull(int fd, unsigned char *buf, size_t len)
+{
+        for (size_t i = 0; i < len;) {
+                const ssize_t n = read(fd, buf + i, len - i);
+                if (n <= 0) return false;
+                i += n;
+        }
+        return true;
+}
+
+
+static bool readPacket(int fd, unsigned char &h, unsigned char *buf, int &len)
+{
+        if (!readFull(fd, &h, 1))
+                return false;
+        int mul = 1;
+        unsigned char c;
+        len = 0;
+        do {
+                assert(readFull(fd, &c, 1));
+                len += (c & 127) * mul;
+                mul *= 128;
+        } while (c & 128);
+        assert(len <= 4096 && readFull(fd, buf, len));
+        return true;
+}
+
+
+static void writeAck(int fd, unsigned char h, int id)
+{
+        const unsigned char ack[] = {h, 2, (unsigned char)(id >> 8),
+                                     (unsigned char)id};
+        assert(write(fd, ack, 4) == 4);
+}
+
+
+// Minimal broker: accepts CONNECT, collects N QoS 1 PUBLISH packets, then
+// acknowledges all of them at once, until DISCONNECT.
+static void *broker(void *arg)
+{
+        const int fd = accept(lfd, NULL, NULL);
+        unsigned char h, buf[4096];
+        int len;
+        while (readPacket(fd, h, buf, len)) {
+                if (h >> 4 == 14) {
+                        break;
+                } else if (h >> 4 == 1) {
+                        const unsigned char ack[] = {0x20, 2, 0, 0};
+                        assert(write(fd, ack, 4) == 4);
+                } else if (h >> 4 == 3) {
+                        assert(((h >> 1) & 3) == 1);
+                        const int tl = (buf[0] << 8) | buf[1];
+                        ids.push_back((buf[2 + tl] << 8) | buf[3 + tl]);
+                        if (ids.size() < N) continue;
+                        for (auto id: ids)
+                                writeAck(fd, 0x40, id);
+                }
+        }
+        close(fd);
+        return NULL;
+}
+
+
+// counts of packets received by the lossy broker
+static int recs, dups, rels, comps;
+
+
+// Lossy broker for QoS 2: on the first connection, it sends a QoS 2 message
+// twice, and only sends PUBREC for every other publish. It drops the
+// connection once the PUBRELs arrive, before sending any PUBCOMP. On the
+// second connection, it releases its message, and completes everything.
+static void *lossy(void *arg)
+{
+        const unsigned char pub[] = {0x34, 11, 0, 4, 's', '/', 'd', 'l',
+                                     0, 7, 'a', 'b', 'c'};
+        unsigned char h, buf[4096];
+        int len, n = 0;
+        int fd = accept(lfd, NULL, NULL);
+        while (rels < N / 2 + 1 && readPacket(fd, h, buf, len)) {
+                if (h >> 4 == 1) {
+                        writeAck(fd, 0x20, 0);
+                        assert(write(fd, pub, sizeof(pub)) == sizeof(pub));
+                        const unsigned char d = pub[0] | 8;
+                        assert(write(fd, &d, 1) == 1);
+                        assert(write(fd, pub + 1, sizeof(pub) - 1) ==
+                               sizeof(pub) - 1);
+                } else if (h >> 4 == 3) {
+                        assert(((h >> 1) & 3) == 2 && (h & 8) == 0);
+                        const int tl = (buf[0] << 8) | buf[1];
+                        if (n++ % 2 == 0)
+                                writeAck(fd, 0x50, (buf[2 + tl] << 8) |
+                                         buf[3 + tl]);
+                } else if (h >> 4 == 5) {
+                        assert(buf[1] == 7);
+                        ++recs;
+                } else if (h >> 4 == 6) {
+                        assert(h == 0x62);
+                        ++rels;
+                }
+        }
+        close(fd);
+        rels = 0;
+        fd = accept(lfd, NULL, NULL);
+        while (readPacket(fd, h, buf, len)) {
+                if (h >> 4 == 14) {
+                        break;
+                } else if (h >> 4 == 1) {
+                        writeAck(fd, 0x20, 0);
+                        writeAck(fd, 0x62, 7);
+                } else if (h >> 4 == 3) {
+                        assert(((h >> 1) & 3) == 2);
+                        const int tl = (buf[0] << 8) | buf[1];
+                        writeAck(fd, 0x50, (buf[2 + tl] << 8) | buf[3 + tl]);
+                        dups += (h & 8) != 0;
+                } else if (h >> 4 == 6) {
+                        writeAck(fd, 0x70, (buf[0] << 8) | buf[1]);
+                        ++rels;
+                } else if (h >> 4 == 7) {
+                        assert(buf[1] == 7);
+                        ++comps;
+                }
+        }
+        close(fd);
+        return NULL;
+}
+
+
+class Handler: public SrMqttAppMsgHandler
+{
+public:
+        Handler(): count(0) {}
+        virtual void operator()(const SrMqttAppView &v) {
+                assert(string(v.data, v.dlen) == "abc");
+                ++count;
+        }
+        int count;
+};
+
+
+int main()
+{
+        cerr << "Test SrNetMqtt inflight: ";
+        sockaddr_in addr = {};
+        socklen_t alen = sizeof(addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        assert(bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        assert(listen(lfd, 1) == 0);
+        assert(getsockname(lfd, (sockaddr*)&addr, &alen) == 0);
+        pthread_t tid;
+        pthread_create(&tid, NULL, broker, NULL);
+
+        const string port = to_string(ntohs(addr.sin_port));
+        SrNetMqtt mqtt("d:test", "http://127.0.0.1:" + port);
+        mqtt.setTimeout(5);
+        assert(mqtt.connect() == 0);
+        vector<int> sent;
+        for (int i = 0; i < N; ++i) {
+                const int packet = mqtt.publishAsync("s/ul", "200,T,1");
+                assert(packet > 0 && mqtt.isInflight(packet));
+                sent.push_back(packet);
+        }
+        assert(mqtt.inflight() == N);
+        // retransmission re-uses the packet ID, it stays in flight once
+        assert(mqtt.publishAsync("s/ul", "200,T,1", 2 | 8, sent[0]) == sent[0]);
+        assert(mqtt.inflight() == N);
+        for (int i = 0; i < 10 && mqtt.inflight(); ++i)
+                assert(mqtt.yield(1000) == 0);
+        assert(mqtt.inflight() == 0);
+        for (int i = 1; i < N; ++i)
+                assert(sent[i] != sent[i - 1]);
+        mqtt.disconnect();
+        pthread_join(tid, NULL);
+        assert(ids.size() == N + 1 && ids[N] == sent[0]);
+        cerr << "OK!" << endl;
+
+        cerr << "Test SrNetMqtt QoS 2: ";
+        pthread_create(&tid, NULL, lossy, NULL);
+        Handler h;
+        mqtt.addMsgHandler("s/dl", &h);
+        assert(mqtt.connect() == 0);
+        sent.clear();
+        for (int i = 0; i < N; ++i) {
+                sent.push_back(mqtt.publishAsync("s/ul", "200,T,1", 4));
+                assert(sent.back() > 0);
+        }
+        for (int i = 0; i < 10 && !mqtt.isReleased(sent[N - 1]); ++i)
+                assert(mqtt.yield(1000) == 0);
+        for (int i = 0; i < N; ++i)
+                assert(mqtt.isInflight(sent[i]) &&
+                       mqtt.isReleased(sent[i]) == (i % 2 == 0));
+        assert(h.count == 1);   // the second copy is not delivered
+        // re-connect, retransmit with DUP, or only the PUBREL once released
+        assert(mqtt.connect(false) == 0);
+        for (auto id: sent)
+                assert(mqtt.publishAsync("s/ul", "200,T,1", 4 | 8, id) == id);
+        for (int i = 0; i < 10 && mqtt.inflight(); ++i)
+                assert(mqtt.yield(1000) == 0);
+        assert(mqtt.inflight() == 0);
+        // synchronous publish waits for the whole exchange, the header is
+        // not limited by a fixed buffer
+        const string topic = "s/ul/" + string(300, 't');
+        assert(mqtt.publish(topic, "200,T,1", 4) == 0 && !mqtt.inflight());
+        mqtt.disconnect();
+        pthread_join(tid, NULL);
+        assert(recs == 2 && comps == 1 && h.count == 1);
+        assert(dups == N / 2 && rels == N + 1);
+        cerr << "OK!" << endl;
+        return 0;
+}
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <srnetmqtt.h>
+using namespace std;
+
+static const int N = 1000;
+static const int Q = 10;
+static int lfd;
+static int acks, pubs;
+
+
+static bool readFull(int fd, unsigned char *buf, size_t len)
+{
+        for (size_t i = 0; i < len;) {
+                const ssize_t n = read(fd, buf + i, len - i);
+                if (n <= 0) return false;
+                i += n;
+        }
+        return true;
+}
+
+
+static string publish(const string &topic, const string &msg, int packet = 0)
+{
+        string s(1, packet ? 0x32 : 0x30);
+        size_t len = 2 + topic.size() + (packet ? 2 : 0) + msg.size();
+        do {
+                s += (char)((len & 127) | (len > 127 ? 128 : 0));
+                len >>= 7;
+        } while (len);
+        s += (char)(topic.size() >> 8);
+        s += (char)topic.size();
+        s += topic;
+        if (packet) {
+                s += (char)(packet >> 8);
+                s += (char)packet;
+        }
+        return s + msg;
+}
+
+
+// Minimal broker: accepts CONNECT, then sends a stream of PUBLISH packets in
+// chunks which split packets at arbitrary bytes, until DISCONNECT.
+static void *broker(void *arg)
+{
+        const int fd = accept(lfd, NULL, NULL);
+        unsigned char h, buf[4096];
+        string out;
+        for (int i = 0; i < N; ++i)
+                out += publish("s/dl", "510," + to_string(i) + "\n");
+        out += publish("s/other", "dropped");
+        for (int i = 1; i <= Q; ++i)
+                out += publish("s/e", "qos1", i);
+        out += publish("s/dl", string(20000, 'x'));
+        out += publish("s/dl", "end");
+        while (readFull(fd, &h, 1)) {
+                int len = 0, mul = 1;
+                unsigned char c;
+                do {
+                        assert(readFull(fd, &c, 1));
+                        len += (c & 127) * mul;
+                        mul *= 128;
+                } while (c & 128);
+                assert(len <= (int)sizeof(buf) && readFull(fd, buf, len));
+                if (h >> 4 == 14) {
+                        break;
+                } else if (h >> 4 == 4) {
+                        ++acks;
+                } else if (h >> 4 == 3) {       // from MsgHandler
+                        assert(((h >> 1) & 3) == 1);
+                        const int tl = (buf[0] << 8) | buf[1];
+                        const unsigned char ack[] = {0x40, 2, buf[2 + tl],
+                                                     buf[3 + tl]};
+                        assert(write(fd, ack, 4) == 4);
+                        ++pubs;
+                } else if (h >> 4 == 1) {
+                        const unsigned char ack[] = {0x20, 2, 0, 0};
+                        assert(write(fd, ack, 4) == 4);
+                        for (size_t i = 0, n = 1; i < out.size(); i += n) {
+                                n = min(out.size() - i, 1 + i % 997);
+                                assert(write(fd, out.data() + i, n) == (int)n);
+                                if (i % 5 == 0) usleep(1000);
+                        }
+                }
+        }
+        close(fd);
+        return NULL;
+}
+
+
+class Handler: public SrMqttAppMsgHandler
+{
+public:
+        Handler(): count(0), size(0), done(false) {}
+        virtual void operator()(const SrMqttAppView &v) {
+                assert(string(v.topic, v.tlen) == "s/dl");
+                const string s(v.data, v.dlen);
+                if (s == "end")
+                        done = true;
+                else if (count < N)
+                        assert(s == "510," + to_string(count) + "\n");
+                ++count;
+                size += v.dlen;
+        }
+        int count;
+        size_t size;
+        bool done;
+};
+
+
+// Only implements the copying callback, and publishes from within.
+class MsgHandler: public SrMqttAppMsgHandler
+{
+public:
+        MsgHandler(SrNetMqtt &m): mqtt(m), count(0) {}
+        virtual void operator()(const SrMqttAppMsg &m) {
+                assert(m.topic == "s/e" && m.data == "qos1");
+                ++count;
+                assert(mqtt.publish("s/ul", "200,T,1", 2) == 0);
+        }
+        SrNetMqtt &mqtt;
+        int count;
+};
+
+
+int main()
+{
+        cerr << "Test SrNetMqtt recv: ";
+        sockaddr_in addr = {};
+        socklen_t alen = sizeof(addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        assert(bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        assert(listen(lfd, 1) == 0);
+        assert(getsockname(lfd, (sockaddr*)&addr, &alen) == 0);
+        pthread_t tid;
+        pthread_create(&tid, NULL, broker, NULL);
+
+        const string port = to_string(ntohs(addr.sin_port));
+        SrNetMqtt mqtt("d:test", "http://127.0.0.1:" + port);
+        Handler h;
+        MsgHandler mh(mqtt);
+        mqtt.addMsgHandler("s/dl", &h);
+        mqtt.addMsgHandler("s/e", &mh);
+        mqtt.setTimeout(5);
+        assert(mqtt.connect() == 0);
+        // serve the connection from an own event loop
+        const int ep = epoll_create1(0);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = mqtt.socket();
+        assert(epoll_ctl(ep, EPOLL_CTL_ADD, mqtt.socket(), &ev) == 0);
+        assert(mqtt.yield(0) == 0);     // CONNACK may carry data already
+        for (int i = 0; i < 1000 && !h.done; ++i) {
+                if (epoll_wait(ep, &ev, 1, 1000) == 1)
+                        assert(mqtt.yield(0) == 0);
+        }
+        assert(h.done && h.count == N + 2 && mh.count == Q);
+        // publishes from the handler are acknowledged later
+        for (int i = 0; i < 100 && mqtt.inflight(); ++i)
+                assert(mqtt.yield(100) == 0);
+        assert(mqtt.inflight() == 0);
+        timespec t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        assert(mqtt.yield(0) == 0);     // nothing to read, does not wait
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        assert((t2.tv_sec - t1.tv_sec) * 1000 +
+               (t2.tv_nsec - t1.tv_nsec) / 1000000 < 500);
+        close(ep);
+        assert(h.size > 20000);
+        mqtt.disconnect();
+        pthread_join(tid, NULL);
+        assert(acks == Q && pubs == Q);
+        cerr << "OK!" << endl;
+        return 0;
+}
@@ -0,0 +1,40 @@
+#include <iostream>
+#include <cassert>
+#include <srmsgtable.h>
+using namespace std;
+
+
+int main()
+{
+        cerr << "Test SrMsgTable: ";
+        int a = 1, b = 2;
+        SrMsgTable<int> t;
+        assert(t.find(0) == NULL && t.find(65535) == NULL);
+        t.set(151, &a);
+        t.set(65535, &b);
+        assert(t.find(151) == &a && t.find(65535) == &b);
+        assert(t.find(150) == NULL);
+        t.set(151, &b);
+        assert(t.find(151) == &b);
+        t.set(151, NULL);
+        assert(t.find(151) == NULL);
+
+        SrXMsgTable<int> x;
+        assert(x.find(0, 0) == NULL);
+        for (uint32_t xid = 1; xid < 64; ++xid)
+                for (uint16_t id = 800; id < 816; ++id)
+                        x.set(xid, id, xid & 1 ? &a : &b);
+        for (uint32_t xid = 1; xid < 64; ++xid) {
+                for (uint16_t id = 800; id < 816; ++id)
+                        assert(x.find(xid, id) == (xid & 1 ? &a : &b));
+                assert(x.find(xid, 816) == NULL);
+        }
+        assert(x.find(0, 800) == NULL);
+        assert(x.find(0xffffffff, 0xffff) == NULL);
+        x.set(0xffffffff, 0xffff, &a);
+        assert(x.find(0xffffffff, 0xffff) == &a);
+        x.set(3, 805, NULL);
+        assert(x.find(3, 805) == NULL && x.find(3, 806) == &a);
+        cerr << "OK!" << endl;
+        return 0;
+}
@@ -0,0 +1,233 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../src/srpager.h"
+using namespace std;
+
+
+int main()
+{
+        cerr << "Test _BFPager: ";
+        char dir[] = "/tmp/test_pagerXXXXXX";
+        assert(mkdtemp(dir));
+        const string fn = string(dir) + "/buf";
+        const size_t ps = _BFPager::pageSize();
+        const string big(ps * 2 + 10, 'x');
+        {
+                _BFPager p(fn, 4);
+                assert(p.empty() && p.bsize() == 0);
+                assert(p.emplace_back("15,100\n") == 0);
+                assert(p.front() == "15,100\n");
+                assert(p.emplace_back("200,a\n") == 0);
+                assert(p.size() == 1 && p.bsize() == 1);
+                // the cached front follows changes of the front batch
+                assert(p.front() == "15,100\n200,a\n");
+                assert(p.emplace_back(big) == 0); // spans 3 new pages
+                assert(p.size() == 4 && p.bsize() == 2);
+                assert(p.front() == "15,100\n200,a\n");
+        }
+        {       // reopen, batches survive
+                _BFPager p(fn, 4);
+                assert(p.size() == 4 && p.bsize() == 2);
+                assert(p.front() == "15,100\n200,a\n");
+                p.pop_front();
+                assert(p.front() == big && p.bsize() == 1);
+                // full, the oldest batch is discarded for the new one
+                assert(p.emplace_back(string(ps, 'y')) == 0);
+                assert(p.emplace_back(string(ps, 'z')) == 0);
+                assert(p.bsize() == 2 && p.front() == string(ps, 'y'));
+                p.pop_front();
+                assert(p.front() == string(ps, 'z'));
+                p.clear();
+                assert(p.empty() && p.front().empty());
+                // cut() starts a new batch, popped() counts removed ones
+                const uint64_t n = p.popped();
+                assert(p.emplace_back("15,100\n") == 0);
+                p.cut();
+                assert(p.emplace_back("200,b\n") == 0);
+                assert(p.bsize() == 2 && p.front() == "15,100\n");
+                p.pop_front();
+                assert(p.popped() == n + 1 && p.front() == "200,b\n");
+                p.clear();
+                assert(p.popped() == n + 2);
+                // clearing an empty buffer writes nothing
+                const uint64_t w = p.indexBytes();
+                p.clear();
+                assert(p.indexBytes() == w);
+        }
+        {
+                _BFPager p(fn, 4);
+                assert(p.empty());
+        }
+        const pid_t pid = fork();
+        if (pid == 0) { // crash without writing a snapshot
+                _BFPager *p = new _BFPager(fn, 4);
+                p->emplace_back("15,100\n");
+                p->emplace_back(big);
+                p->emplace_back("200,b\n");
+                p->pop_front();
+                _exit(0);
+        }
+        int status = 0;
+        assert(waitpid(pid, &status, 0) == pid && status == 0);
+        {       // the journal is replayed on top of the snapshot
+                _BFPager p(fn, 4);
+                assert(p.size() == 3 && p.bsize() == 1);
+                assert(p.front() == big + "200,b\n");
+        }
+        unlink(fn.c_str());
+        unlink((fn + SR_FILEBUF_INDEX_SUFFIX).c_str());
+        unlink((fn + SR_FILEBUF_JOURNAL_SUFFIX).c_str());
+        {       // segments of 4 pages
+                _BFPager p(fn, 10, 2);
+                for (char c = 'a'; c < 'e'; ++c)
+                        assert(p.emplace_back(string(ps * 2, c)) == 0);
+                assert(p.size() == 8 && access((fn + ".1").c_str(), 0) == 0);
+                // segments are created as their pages are used
+                assert(access((fn + ".2").c_str(), 0) == -1);
+        }
+        {
+                _BFPager p(fn, 10);     // segment size is kept
+                assert(p.size() == 8 && p.bsize() == 4);
+                assert(p.front() == string(ps * 2, 'a'));
+                p.pop_front();
+                assert(p.emplace_back(string(ps * 4, 'e')) == 0);
+                assert(access((fn + ".2").c_str(), 0) == 0);
+                for (char c = 'b'; c < 'f'; ++c, p.pop_front())
+                        assert(p.front() == string(ps * (c == 'e' ? 4 : 2), c));
+                p.setCapacity(4);
+                p.clear();
+                assert(access((fn + ".1").c_str(), 0) == -1);
+                assert(access((fn + ".2").c_str(), 0) == -1);
+        }
+        {       // pages of a segment which cannot be mapped
+                _BFPager p(fn, 10, 2);
+                for (char c = 'a'; c < 'e'; ++c)
+                        assert(p.emplace_back(string(ps * 2, c)) == 0);
+        }
+        assert(unlink((fn + ".1").c_str()) == 0);
+        assert(mkdir((fn + ".1").c_str(), 0700) == 0);
+        {
+                _BFPager p(fn, 10);
+                assert(p.empty() && p.emplace_back("15,100\n") == 0);
+                // needs the segment, fails without touching the buffer
+                assert(p.emplace_back(string(ps * 4, 'z')) == -1);
+                assert(p.size() == 1 && p.front() == "15,100\n");
+        }
+        assert(rmdir((fn + ".1").c_str()) == 0);
+        unlink((fn + ".2").c_str());
+        const pid_t pid2 = fork();
+        if (pid2 == 0) {        // no space left, the blocks are allocated
+                signal(SIGXFSZ, SIG_IGN);
+                const rlimit rl = {8 * ps, 8 * ps};
+                setrlimit(RLIMIT_FSIZE, &rl);
+                _BFPager *p = new _BFPager(fn + "x", 100);
+                _exit(p->emplace_back(string(ps * 16, 'a')) == -1 ? 0 : 1);
+        }
+        assert(waitpid(pid2, &status, 0) == pid2 && status == 0);
+        unlink((fn + "x").c_str());
+        unlink((fn + "x" SR_FILEBUF_INDEX_SUFFIX).c_str());
+        unlink((fn + "x" SR_FILEBUF_JOURNAL_SUFFIX).c_str());
+        unlink(fn.c_str());
+        unlink((fn + SR_FILEBUF_INDEX_SUFFIX).c_str());
+        unlink((fn + SR_FILEBUF_JOURNAL_SUFFIX).c_str());
+        {       // version 1 buffer, pages 2 and 5 of one batch, then page 0
+                const string a(ps, 'a'), b = "15,100\n", c = "200,c\n";
+                FILE *fp = fopen(fn.c_str(), "w");
+                fseek(fp, 2 * ps, SEEK_SET);
+                fwrite(a.data(), 1, a.size(), fp);
+                fseek(fp, 5 * ps, SEEK_SET);
+                fwrite(b.data(), 1, b.size(), fp);
+                fseek(fp, 0, SEEK_SET);
+                fwrite(c.data(), 1, c.size(), fp);
+                fclose(fp);
+                uint8_t scale = 0;
+                while ((size_t)512 << scale < ps)
+                        ++scale;
+                const uint16_t idx[] = {(uint8_t)(scale | 1 << 3), 3, 2, 7,
+                                        2, (uint16_t)(ps - 1), 0, 0,
+                                        5, (uint16_t)(b.size() - 1), 0, 0,
+                                        0, (uint16_t)(c.size() - 1), 1, 0};
+                // the head is {u8 base, flag; u16 size, cnt, gen}, so the
+                // first element packs base and flag
+                fp = fopen((fn + SR_FILEBUF_INDEX_SUFFIX).c_str(), "w");
+                fwrite(idx, sizeof(idx), 1, fp);
+                fclose(fp);
+                _BFPager p(fn, 8, 2);
+                assert(p.size() == 3 && p.bsize() == 2);
+                assert(p.front() == a + b);
+                p.pop_front();
+                assert(p.front() == c);
+        }
+        {
+                _BFPager p(fn, 8);
+                assert(p.size() == 1 && p.front() == "200,c\n");
+                assert(access((fn + ".1").c_str(), 0) == -1);
+                p.clear();
+        }
+        const string dict = "10,100,POST,/measurement/measurements,,,"
+                "c8y_Temperature\n";
+        string req = "15,100\n";
+        for (int i = 0; i < 100; ++i)
+                req += "100,c8y_Temperature," + to_string(i % 10) + "\n";
+        {       // compressed frames mixed with raw requests
+                _BFPager p(fn, 8);
+                assert(p.setCompression(dict) == 0);
+                assert(p.emplace_back(req) == 0);
+                assert(p.emplace_back("200,a\n") == 0);
+                assert(p.size() == 1 && p.front() == req + "200,a\n");
+        }
+        {
+                _BFPager p(fn, 8);      // no dictionary, the frame is lost
+                assert(p.size() == 1 && p.front() == "200,a\n");
+                assert(p.setCompression("other") == 0);
+                assert(p.front() == "200,a\n");
+                assert(p.setCompression(dict) == 0);
+                assert(p.front() == req + "200,a\n");
+                p.clear();
+        }
+        cerr << "OK!" << endl;
+        cerr << "Test _MemPager: ";
+        const string line = "100,c8y_Temperature,25\n";
+        size_t kept[2];
+        for (int z = 0; z < 2; ++z) {
+                _MemPager p(64);        // 4 KB
+                assert(z == 0 || p.setCompression(dict) == 0);
+                assert(p.empty() && p.front().empty());
+                p.emplace_back("15,100\n");
+                for (int i = 0; i < 4000; ++i)
+                        p.emplace_back(line);
+                assert(p.size() <= 64 + 16 && p.bsize() > 1);
+                string all;
+                for (size_t n = p.bsize(); n; --n, p.pop_front()) {
+                        const string &s = p.front();
+                        assert(s.compare(0, 7, "15,100\n") == 0);
+                        assert(s.size() % line.size() == 7);
+                        all += s;
+                }
+                assert(p.empty() && p.size() == 0);
+                kept[z] = all.size();
+                const uint64_t n = p.popped();
+                p.emplace_back(line);
+                p.cut();
+                p.emplace_back(line);
+                assert(p.bsize() == 2 && p.front() == "15,100\n" + line);
+                p.clear();
+                assert(p.empty() && p.popped() == n + 2);
+        }
+        // compressed batches take less of the budget
+        assert(kept[0] < 6000 && kept[1] > 3 * kept[0]);
+        unlink(fn.c_str());
+        unlink((fn + SR_FILEBUF_INDEX_SUFFIX).c_str());
+        unlink((fn + SR_FILEBUF_JOURNAL_SUFFIX).c_str());
+        rmdir(dir);
+        cerr << "OK!" << endl;
+        return 0;
+}
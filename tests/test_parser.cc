@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cassert>
+#include <cstdlib>
 #include <smartrest.h>
 using namespace std;
 
@@ -19,6 +20,29 @@ int main()
         assert(r.value(1) == "hello world");
         r = sr.next();
         assert(r.size() == 0);
+
+        const string s = "1,2,3,4,5,6,7,8,9,\"x\"\"y\",11\n12";
+        SrParser sr2(s.c_str(), s.size());
+        SrRecord r2;
+        assert(sr2.next(r2) == 11);
+        assert(r2.data(0) == s.c_str() && r2.length(0) == 1);
+        assert(r2.equals(8, "9") && r2.type(8) == SrLexer::SR_INT);
+        assert(r2.equals(9, "x\"y") && r2.value(9) == "x\"y");
+        assert(r2[10].second == "11");
+        SrRecord r3(r2);
+        assert(sr2.next(r2) == 1 && r2.equals(0, "12"));
+        assert(sr2.next(r2) == 0);
+        assert(r3.size() == 11 && r3.value(10) == "11");
+        assert(r3.data(0) != s.c_str());
+        assert(r3.asMsgId() == 1 && r3.asInt(10) == 11);
+
+        const string t = "813,-42,\"7\",2.5e3,12abc,99999999999999999999999\n";
+        SrParser sr3(t.c_str(), t.size());
+        assert(sr3.next(r2) == 6);
+        assert(r2.asMsgId() == 813 && r2.asInt(1) == -42);
+        assert(r2.asInt(2) == 7 && r2.asDouble(3) == 2500.0);
+        assert(r2.asInt(4) == 12 && r2.asDouble(1) == -42.0);
+        assert(r2.asInt(5) == strtol(r2.value(5).c_str(), NULL, 10));
         cerr << "OK!" << endl;
         return 0;
 }
@@ -1,7 +1,9 @@
 #include <string>
 #include <set>
+#include <vector>
 #include <iostream>
 #include <cassert>
+#include <unistd.h>
 #include <srqueue.h>
 using namespace std;
 
@@ -25,6 +27,24 @@ void *func(void *arg)
 }
 
 
+static bool sameKey(const string &a, const string &b)
+{
+        return a.compare(0, a.find(','), b, 0, b.find(',')) == 0;
+}
+
+
+static void *consumer(void *arg)
+{
+        SrQueue<string> *q = (SrQueue<string>*)arg;
+        usleep(20 * 1000);
+        vector<string> v;
+        for (size_t n = 0; n < 5;)
+                n += q->drain(v, 8, 1000);
+        assert(v == vector<string>({"1", "2", "3", "4", "5"}));
+        return NULL;
+}
+
+
 int main()
 {
         cerr << "Test SrQueue: ";
@@ -41,6 +61,45 @@ int main()
         }
         pthread_join(tid, NULL);
         assert(S == S2);
+
+        string big(4096, 'x');
+        const char *p = big.data();
+        assert(Q.put(std::move(big)) == 0);
+        auto e = Q.get(0);
+        assert(e.second == SrQueue<string>::Q_OK && e.first.data() == p);
+        assert(Q.get(0).second == SrQueue<string>::Q_TIMEOUT);
+        assert(Q.emplace(3, 'a') == 0);
+        vector<string> v = {"1", "2", "3"};
+        assert(Q.putMany(std::move(v)) == 0 && v.empty());
+        vector<string> out;
+        assert(Q.drain(out, 2, 0) == 2);
+        assert(Q.drain(out, 8, 100) == 2);
+        assert(out == vector<string>({"aaa", "1", "2", "3"}));
+        assert(Q.drain(out, 8, 10) == 0 && out.size() == 4);
+
+        // bounded queue, overflow policies
+        SrQueue<string> q1(2, SrQueue<string>::Q_DROP_NEWEST);
+        assert(q1.put("a") == 0 && q1.put("b") == 0 && q1.put("c") == -1);
+        assert(q1.size() == 2 && q1.dropped() == 1);
+        q1.setCapacity(2, SrQueue<string>::Q_DROP_OLDEST);
+        assert(q1.put("c") == 0 && q1.size() == 2 && q1.dropped() == 2);
+        assert(q1.get(0).first == "b" && q1.get(0).first == "c");
+        q1.setCapacity(3, SrQueue<string>::Q_COALESCE, sameKey);
+        assert(q1.put("1,a") == 0 && q1.put("2,a") == 0);
+        assert(q1.put("3,a") == 0 && q1.put("2,b") == 0);
+        assert(q1.put("4,a") == 0 && q1.dropped() == 4);
+        out.clear();
+        assert(q1.drain(out, 8, 0) == 3);
+        assert(out == vector<string>({"2,b", "3,a", "4,a"}));
+
+        // Q_BLOCK, putMany waits for the consumer instead of dropping
+        SrQueue<string> q2(2);
+        pthread_t tid2;
+        pthread_create(&tid2, NULL, consumer, &q2);
+        vector<string> v2 = {"1", "2", "3", "4", "5"};
+        assert(q2.putMany(std::move(v2)) == 0);
+        pthread_join(tid2, NULL);
+        assert(q2.blocked() > 0 && q2.dropped() == 0 && q2.empty());
         cerr << "OK!" << endl;
         return 0;
 }
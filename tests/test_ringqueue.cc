@@ -0,0 +1,62 @@
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <srringqueue.h>
+using namespace std;
+
+typedef SrRingQueue<pair<int, int> > Ring;
+static const int P = 4;
+static const int N = 100000;
+static Ring ring(64);
+
+
+static void *producer(void *arg)
+{
+        const int id = (long)arg;
+        for (int i = 0; i < N; ++i)
+                while (ring.put(make_pair(id, i)) == -1)
+                        sched_yield();
+        return NULL;
+}
+
+
+int main()
+{
+        cerr << "Test SrRingQueue: ";
+        SrRingQueue<int> q(3);
+        assert(q.capacity() == 4 && q.empty());
+        for (int i = 0; i < 4; ++i)
+                assert(q.put(i) == 0);
+        assert(q.put(4) == -1 && q.size() == 4);
+        for (int i = 0; i < 4; ++i) {
+                SrRingQueue<int>::Event e = q.get(0);
+                assert(e.second == SrRingQueue<int>::Q_OK && e.first == i);
+        }
+        assert(q.get(0).second == SrRingQueue<int>::Q_TIMEOUT);
+        timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        assert(q.get(50).second == SrRingQueue<int>::Q_TIMEOUT);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        assert((t1.tv_sec - t0.tv_sec) * 1000 +
+               (t1.tv_nsec - t0.tv_nsec) / 1000000 >= 49);
+
+        // elements of each producer arrive in order, none lost
+        pthread_t tids[P];
+        for (long i = 0; i < P; ++i)
+                pthread_create(&tids[i], NULL, producer, (void*)i);
+        vector<int> next(P, 0);
+        for (int i = 0; i < P * N; ++i) {
+                Ring::Event e = ring.get(1000);
+                assert(e.second == Ring::Q_OK);
+                assert(e.first.second == next[e.first.first]++);
+        }
+        for (int i = 0; i < P; ++i) {
+                pthread_join(tids[i], NULL);
+                assert(next[i] == N);
+        }
+        assert(ring.empty());
+        cerr << "OK!" << endl;
+        return 0;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <cassert>
+#include <srtimer.h>
+using namespace std;
+
+
+int main()
+{
+        cerr << "Test SrTimerQueue: ";
+        SrTimerQueue q;
+        vector<SrTimer*> v;
+        for (int i = 0; i < 64; ++i) {
+                v.push_back(new SrTimer((i * 7919) % 1000 + 1000));
+                if (i % 2) v.back()->start();  // started before or after add
+                q.add(*v.back());
+                q.add(*v.back());               // no duplicate
+                if (i % 2 == 0) v.back()->start();
+        }
+        v[5]->stop();
+        v[6]->stop();
+        v[7]->setInterval(10);
+        v[7]->start();
+        delete v[8];
+        assert(q.top() == v[7]);
+
+        SrTimer *prev = q.pop();
+        assert(prev == v[7] && prev->isActive());
+        size_t n = 1;
+        while (!q.empty()) {
+                SrTimer *t = q.pop();
+                assert(prev->fireTime() <= t->fireTime());
+                assert(t != v[5] && t != v[6]);
+                prev = t;
+                ++n;
+        }
+        assert(n == 61);
+
+        v[5]->start();
+        assert(!q.empty() && q.top() == v[5]);
+        SrTimer copy(*v[5]);
+        copy.stop();
+        assert(q.top() == v[5] && v[5]->isActive());
+        {
+                SrTimerQueue q2;
+                q2.add(*v[9]);
+                v[9]->start();
+                assert(q2.top() == v[9]);
+        }
+        v[9]->stop();                           // detached, no dangling queue
+        for (size_t i = 0; i < v.size(); ++i)
+                if (i != 8) delete v[i];
+        assert(q.empty());
+        cerr << "OK!" << endl;
+        return 0;
+}
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <srnetmqtt.h>
+#include "../src/srtopictrie.h"
+using namespace std;
+
+typedef vector<_TopicTrie::Handler> Hits;
+
+
+static Hits match(const _TopicTrie &trie, const string &t)
+{
+        Hits v;
+        trie.match(t.data(), t.size(), v);
+        return v;
+}
+
+
+int main()
+{
+        cerr << "Test _TopicTrie: ";
+        SrMqttAppMsgHandler h[8];
+        _TopicTrie trie;
+        trie.add("s/dl", &h[0]);
+        trie.add("s/ol/+", &h[1]);
+        trie.add("s/ol/+", &h[2]);      // multiple handlers per filter
+        trie.add("s/#", &h[3]);
+        trie.add("#", &h[4]);
+        trie.add("+/e", &h[5]);
+        trie.add("s/ol/dev", &h[1]);    // overlapping, invoked once
+        trie.add("a//b", &h[6]);
+
+        assert(match(trie, "s/dl") == Hits({&h[4], &h[3], &h[0]}));
+        assert(match(trie, "s/ol/dev") == Hits({&h[4], &h[3], &h[1], &h[2]}));
+        assert(match(trie, "s/ol/x") == Hits({&h[4], &h[3], &h[1], &h[2]}));
+        // '#' includes the parent level, '+' matches exactly one level
+        assert(match(trie, "s") == Hits({&h[4], &h[3]}));
+        assert(match(trie, "s/ol/x/y") == Hits({&h[4], &h[3]}));
+        assert(match(trie, "s/e") == Hits({&h[4], &h[3], &h[5]}));
+        assert(match(trie, "x/e") == Hits({&h[4], &h[5]}));
+        assert(match(trie, "a//b") == Hits({&h[4], &h[6]}));
+        assert(match(trie, "a/b") == Hits({&h[4]}));
+        // first level wildcards do not match '$' topics
+        assert(match(trie, "$SYS/e").empty());
+        trie.add("$SYS/+", &h[7]);
+        assert(match(trie, "$SYS/e") == Hits({&h[7]}));
+        // NULL clears the handlers of a filter
+        trie.add("#", NULL);
+        trie.add("s/ol/+", NULL);
+        assert(match(trie, "s/ol/x") == Hits({&h[3]}));
+        assert(match(trie, "s/ol/dev") == Hits({&h[3], &h[1]}));
+        assert(match(trie, "q").empty());
+        cerr << "OK!" << endl;
+        return 0;
+}